@@ -5,6 +5,7 @@
 #include <ctype.h>
 #include <assert.h>
 #include <stdbool.h>
+#include <time.h>
 
 /* Largest integer formed by 2 digits in a number 
  * - Order matters, cant look backwards.
@@ -247,10 +248,22 @@ void graph_init(graph_t* graph, const char* str) {
     }
 }
 
+void graph_destroy(graph_t* graph) {
+    for (size_t i = 0; i < graph->len; i++) {
+        free(graph->nodes[i].edges);
+    }
+    free(graph->nodes);
+    free(graph);
+}
+
 char graph_node_value(graph_node_t* node) {
     return (*node->c);
 }
 
+// The graph solver traces every step, which drowns out anything else on
+// stdout. The benchmark turns it off.
+static bool graph_debug = true;
+
 typedef struct {
     size_t** buf;
     size_t   max_depth;
@@ -271,6 +284,16 @@ void memo_table_put_value(memo_table_t* table, size_t depth, size_t node_id, siz
     table->buf[depth][node_id] = value;
 }
 
+void memo_table_free(memo_table_t* table) {
+    for (size_t i = 0; i < table->max_depth; i++) {
+        free(table->buf[i]);
+    }
+    free(table->buf);
+    table->buf = NULL;
+    table->max_depth = 0;
+    table->n = 0;
+}
+
 size_t memo_table_get_value(memo_table_t* table, size_t depth, size_t node_id) {
     return table->buf[depth][node_id];
 }
@@ -290,13 +313,15 @@ void memo_table_dbg(memo_table_t* table) {
 // need a memo table for each node that tracks max value for each current depth
 uint64_t graph_max_from_node(graph_node_t* node, int n_digits, int max_digits, uint64_t value, memo_table_t* table) {
     if (n_digits > max_digits) {
-        printf("over max depth for node '%c' at depth %i, returning current value %zu\n", *node->c, n_digits, value);
+        if (graph_debug)
+            printf("over max depth for node '%c' at depth %i, returning current value %zu\n", *node->c, n_digits, value);
         return value;
     }
 
     size_t memo_value = memo_table_get_value(table, n_digits, node->id);
     if (memo_value != 0) {
-        printf("max value from '%c' at depth %i = %zu\n", *node->c, n_digits, memo_value);
+        if (graph_debug)
+            printf("max value from '%c' at depth %i = %zu\n", *node->c, n_digits, memo_value);
         return memo_value;
     }
 
@@ -306,7 +331,8 @@ uint64_t graph_max_from_node(graph_node_t* node, int n_digits, int max_digits, u
     uint64_t max_value = value;
     for (int i = 0; i < node->num_edges; i++) {
         uint64_t edge_val = graph_max_from_node(node->edges[i], n_digits + 1, max_digits, value, table);
-        printf("edge value: %zu\n", edge_val);
+        if (graph_debug)
+            printf("edge value: %zu\n", edge_val);
         if (edge_val > max_value) {
             max_value = edge_val;
         }
@@ -324,8 +350,10 @@ uint64_t graph_calculate_max(graph_t* graph, int max_digits) {
         if (val > max) {
             max = val;
         }
-        memo_table_dbg(&memo);
+        if (graph_debug)
+            memo_table_dbg(&memo);
     }
+    memo_table_free(&memo);
     return max;
 }
 
@@ -438,14 +466,190 @@ void test_find() {
     assert(find_largest_n_digit_value("1111111111119", 12) == 111111111119);
     assert(find_largest_n_digit_value("818181911112111", 12) == 888911112111);
 }
+/* Same answer as find_largest_n_digit_value, but each digit costs at most
+ * two scans of its window instead of one per candidate digit. A '9' can't
+ * be beaten so look for that first with memchr, and only fall back to a
+ * max scan when the window has none.
+ * */
+uint64_t max_subsequence_value(const char* bank, size_t len, int k) {
+    assert(k > 0 && (size_t)k <= len);
+    uint64_t value = 0;
+    size_t pos = 0;
+    for (int picked = 0; picked < k; picked++) {
+        size_t window = len - (size_t)(k - picked) - pos + 1;
+        const char* best = memchr(bank + pos, '9', window);
+        if (best == NULL) {
+            best = bank + pos;
+            for (size_t i = 1; i < window; i++) {
+                if (bank[pos + i] > *best)
+                    best = bank + pos + i;
+            }
+        }
+        value = value * 10 + (*best - '0');
+        pos = (size_t)(best - bank) + 1;
+    }
+    return value;
+}
+
+void test_subsequence() {
+    assert(max_subsequence_value("1234", 4, 2) == 34);
+    assert(max_subsequence_value("987654321111111", 15, 2) == 98);
+    assert(max_subsequence_value("811111111111119", 15, 2) == 89);
+    assert(max_subsequence_value("234234234234278", 15, 2) == 78);
+    assert(max_subsequence_value("818181911112111", 15, 2) == 92);
+
+    assert(max_subsequence_value("987654321111111", 15, 12) == 987654321111);
+    assert(max_subsequence_value("234234234234278", 15, 12) == 434234234278);
+    assert(max_subsequence_value("811111111111119", 15, 12) == 811111111119);
+    assert(max_subsequence_value("818181911112111", 15, 12) == 888911112111);
+
+    printf("test_subsequence passed.\n");
+}
+
+/* Benchmark for the joltage solvers.
+ * Generates `count` random banks of `len` digits (1-9), laid out like the
+ * input file (digits then a newline), and times each solver over all of
+ * them for a handful of k. Output is CSV on stdout. The `agree` column
+ * compares each solver against max_subsequence_value.
+ *
+ * get_max_joltage only knows k = 2, and the graph solver allocates
+ * len^2 edges, so it is skipped above BENCH_GRAPH_MAX_LEN.
+ * */
+#define BENCH_GRAPH_MAX_LEN 256
+#define BENCH_DEFAULT_LEN   100
+#define BENCH_DEFAULT_COUNT 10000
+
+enum {
+    SOLVER_TABLE,
+    SOLVER_GRAPH,
+    SOLVER_FIND,
+    SOLVER_SUBSEQUENCE,
+    SOLVER_COUNT,
+};
+
+static const char* solver_names[SOLVER_COUNT] = {
+    "get_max_joltage",
+    "graph_calculate_max",
+    "find_largest_n_digit_value",
+    "max_subsequence_value",
+};
+
+static double now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+uint64_t run_solver(int solver, const char* bank, size_t len, int k, digit_table_t* table) {
+    switch (solver) {
+        case SOLVER_TABLE:
+            return get_max_joltage(bank, table);
+        case SOLVER_GRAPH: {
+            graph_t* graph = connection_array_create(len);
+            graph_init(graph, bank);
+            uint64_t value = graph_calculate_max(graph, k);
+            graph_destroy(graph);
+            return value;
+        }
+        case SOLVER_FIND:
+            return find_largest_n_digit_value(bank, k);
+        case SOLVER_SUBSEQUENCE:
+            return max_subsequence_value(bank, len, k);
+    }
+    assert(false);
+    return 0;
+}
+
+bool solver_supports(int solver, size_t len, int k) {
+    if (solver == SOLVER_TABLE)
+        return k == 2;
+    if (solver == SOLVER_GRAPH)
+        return len <= BENCH_GRAPH_MAX_LEN;
+    return true;
+}
+
+void bench_solvers(size_t len, size_t count, unsigned seed) {
+    static const int ks[] = { 2, 4, 8, 12, 16 };
+    const size_t num_ks = sizeof(ks) / sizeof(ks[0]);
+
+    size_t stride = len + 2; // digits, newline, terminator
+    char* banks = (char*)malloc(stride * count);
+    srand(seed);
+    for (size_t b = 0; b < count; b++) {
+        char* bank = banks + b * stride;
+        for (size_t i = 0; i < len; i++) {
+            bank[i] = '1' + rand() % 9;
+        }
+        bank[len] = '\n';
+        bank[len + 1] = '\0';
+    }
+
+    uint64_t* expected = (uint64_t*)malloc(sizeof(uint64_t) * count);
+    digit_table_t* table = digit_table_create();
+    graph_debug = false;
+
+    printf("solver,k,bank_len,banks,ns_per_digit,banks_per_sec,agree\n");
+    for (size_t ki = 0; ki < num_ks; ki++) {
+        int k = ks[ki];
+        if ((size_t)k > len)
+            continue;
+
+        for (size_t b = 0; b < count; b++) {
+            expected[b] = max_subsequence_value(banks + b * stride, len, k);
+        }
+
+        for (int solver = 0; solver < SOLVER_COUNT; solver++) {
+            if (!solver_supports(solver, len, k))
+                continue;
+
+            size_t mismatches = 0;
+            double start = now_ns();
+            for (size_t b = 0; b < count; b++) {
+                uint64_t value = run_solver(solver, banks + b * stride, len, k, table);
+                if (value != expected[b])
+                    mismatches++;
+            }
+            double elapsed = now_ns() - start;
+
+            printf("%s,%d,%zu,%zu,%.3f,%.0f,%s\n",
+                    solver_names[solver], k, len, count,
+                    elapsed / (double)(len * count),
+                    (double)count * 1e9 / elapsed,
+                    mismatches == 0 ? "yes" : "no");
+            if (mismatches != 0) {
+                fprintf(stderr, "%s: %zu of %zu banks disagree at k=%d\n",
+                        solver_names[solver], mismatches, count, k);
+            }
+        }
+    }
+
+    free(table->table);
+    free(table);
+    free(expected);
+    free(banks);
+}
+
 /*
  * Part 2 is likely a tree or DAG.
+ *
+ * `./lobby bench [bank_len] [num_banks] [seed]` runs the solver benchmark
+ * instead of the puzzle.
  * */
-int main() {
+int main(int argc, char** argv) {
+    if (argc > 1 && strcmp(argv[1], "bench") == 0) {
+        size_t len   = argc > 2 ? strtoull(argv[2], NULL, 10) : BENCH_DEFAULT_LEN;
+        size_t count = argc > 3 ? strtoull(argv[3], NULL, 10) : BENCH_DEFAULT_COUNT;
+        unsigned seed = argc > 4 ? (unsigned)strtoul(argv[4], NULL, 10) : 1;
+        bench_solvers(len, count, seed);
+        return 0;
+    }
+
+
     // test_str();
     // test_table();
     // test_bank();
     // test_find();
+    // test_subsequence();
     
     FILE* file = fopen("input.txt", "r");
     if (file == NULL) {
@@ -4,225 +4,1922 @@
 #include <stdbool.h>
 #include <assert.h>
 #include <string.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/ioctl.h>
+#include <time.h>
+#include <linux/perf_event.h>
 
-typedef struct grid_node grid_node_t;
-typedef struct grid_node {
-    int val;
-    size_t n; // num adjacent nodes, will be 8 for most in the grid.
-    size_t cap;
-    grid_node_t** adj;
-} grid_node_t;
+/* lanes_t holds LANES consecutive words of a row, see row_lt4_mask. */
+#if defined(__AVX2__)
+#define LANES 4
+#elif defined(__SSE2__)
+#define LANES 2
+#else
+#define LANES 1
+#endif
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+typedef uint64_t lanes_t __attribute__((vector_size(LANES * sizeof(uint64_t))));
 
-#define DEFAULT_NODE_CAP 8
-#define DEFAULT_NODE_VAL -1
+/* One bit per cell, rows packed into 64-bit words. Bit j % 64 of word
+ * j / 64 is column j, so the low bit of word 0 is the leftmost cell.
+ * `paper` holds the rolls, `accessible` is scratch space the passes fill
+ * in.
+ *
+ * Every plane has an empty border: a zero row above the first row and
+ * below the last, and a zero guard word on both sides of every row. The
+ * stencils can read any neighbor of any cell, including row -1, row
+ * `height`, column -1 and column `width`, without bounds checks. `words`
+ * is rounded up to a multiple of LANES so the vector loads never run
+ * past the right guard. Everything outside the grid is always 0.
+ * */
+typedef struct {
+    size_t width;  // cells per row
+    size_t height; // rows in use
+    size_t words;  // data words per row
+    size_t stride; // words per row including the guard words
+    size_t cap;    // rows allocated, not counting the border rows
+    uint64_t* paper;
+    uint64_t* accessible;
+} bitgrid_t;
 
-#define NODE_EMPTY      0
-#define NODE_PAPER      (1 << 1) 
-#define NODE_ACCESSIBLE (1 << 2)
+#define WORD_BITS 64
+#define DEFAULT_ROW_CAP 256
 
-void grid_node_destroy(grid_node_t* node) {
-    node->val = DEFAULT_NODE_VAL;
-    node->n = 0;
-    free(node->adj);
-    node->adj = NULL;
-    node->cap = 0;
+// Data words for a row of `width` cells, rounded up to whole lanes.
+size_t row_words(size_t width) {
+    size_t words = (width + WORD_BITS - 1) / WORD_BITS;
+    return (words + LANES - 1) / LANES * LANES;
 }
 
-typedef struct {
-    size_t n;
-    size_t cap;
-    size_t stride;
-    grid_node_t* nodes;
-} grid_t;
-
-grid_t* grid_create(size_t stride, size_t initial_cap) {
-    grid_t* grid = (grid_t*)malloc(sizeof(grid_t));
-    grid->stride = stride;
-    grid->n = 0;
-    grid->nodes = (grid_node_t*)malloc(sizeof(grid_node_t) * initial_cap);
-    grid->cap = initial_cap;
+size_t bitgrid_plane_words(bitgrid_t* grid, size_t rows) {
+    return (rows + 2) * grid->stride;
+}
+
+bitgrid_t* bitgrid_create(size_t width, size_t initial_rows) {
+    bitgrid_t* grid = (bitgrid_t*)malloc(sizeof(bitgrid_t));
+    grid->width = width;
+    grid->height = 0;
+    grid->words = row_words(width);
+    grid->stride = grid->words + 2;
+    grid->cap = initial_rows;
+    grid->paper = (uint64_t*)calloc(bitgrid_plane_words(grid, initial_rows), sizeof(uint64_t));
+    grid->accessible = (uint64_t*)calloc(bitgrid_plane_words(grid, initial_rows), sizeof(uint64_t));
     return grid;
 }
 
-void grid_destroy(grid_t* grid) {
-    free(grid->nodes);
-    grid->nodes = NULL;
+void bitgrid_destroy(bitgrid_t* grid) {
+    free(grid->paper);
+    free(grid->accessible);
+    grid->paper = NULL;
+    grid->accessible = NULL;
     grid->cap = 0;
-    grid->n = 0;
+    grid->height = 0;
+    free(grid);
+}
+
+bitgrid_t* bitgrid_copy(bitgrid_t* grid) {
+    bitgrid_t* copy = bitgrid_create(grid->width, grid->height > 0 ? grid->height : 1);
+    copy->height = grid->height;
+    size_t n = bitgrid_plane_words(grid, grid->height);
+    memcpy(copy->paper, grid->paper, n * sizeof(uint64_t));
+    memcpy(copy->accessible, grid->accessible, n * sizeof(uint64_t));
+    return copy;
 }
 
-size_t grid_len(grid_t* grid) {
-    return grid->n;
+bool bitgrid_equal(bitgrid_t* a, uint64_t* plane_a, bitgrid_t* b, uint64_t* plane_b) {
+    if (a->width != b->width || a->height != b->height)
+        return false;
+    return memcmp(plane_a, plane_b, bitgrid_plane_words(a, a->height) * sizeof(uint64_t)) == 0;
 }
 
-grid_node_t* grid_add_node(grid_t* grid, int val) {
-    if (grid->n >= grid->cap) {
+size_t bitgrid_cells(bitgrid_t* grid) {
+    return grid->width * grid->height;
+}
+
+// Row -1 and row `height` are the border rows.
+uint64_t* bitgrid_row(bitgrid_t* grid, uint64_t* plane, ptrdiff_t row) {
+    return plane + (row + 1) * grid->stride + 1;
+}
+
+// Column -1 and column `width` land in the guard words.
+bool bitgrid_get(bitgrid_t* grid, uint64_t* plane, ptrdiff_t row, ptrdiff_t col) {
+    size_t bit = (size_t)(col + WORD_BITS);
+    uint64_t word = bitgrid_row(grid, plane, row)[(ptrdiff_t)(bit / WORD_BITS) - 1];
+    return (word >> (bit % WORD_BITS)) & 1;
+}
+
+void bitgrid_set(bitgrid_t* grid, uint64_t* plane, size_t row, size_t col) {
+    bitgrid_row(grid, plane, row)[col / WORD_BITS] |= (uint64_t)1 << (col % WORD_BITS);
+}
+
+void bitgrid_unset(bitgrid_t* grid, uint64_t* plane, size_t row, size_t col) {
+    bitgrid_row(grid, plane, row)[col / WORD_BITS] &= ~((uint64_t)1 << (col % WORD_BITS));
+}
+
+// Appends an empty row and returns its paper words.
+uint64_t* bitgrid_add_row(bitgrid_t* grid) {
+    if (grid->height >= grid->cap) {
         size_t new_cap = grid->cap * 2;
-        grid->nodes = (grid_node_t*)realloc(grid->nodes, new_cap * sizeof(grid_node_t));
+        size_t n = bitgrid_plane_words(grid, new_cap);
+        grid->paper = (uint64_t*)realloc(grid->paper, n * sizeof(uint64_t));
+        grid->accessible = (uint64_t*)realloc(grid->accessible, n * sizeof(uint64_t));
         grid->cap = new_cap;
     }
+    // the new row plus the bottom border under it, guard words included.
+    size_t offset = (grid->height + 1) * grid->stride;
+    memset(grid->paper + offset, 0, 2 * grid->stride * sizeof(uint64_t));
+    memset(grid->accessible + offset, 0, 2 * grid->stride * sizeof(uint64_t));
+    grid->height++;
+    return bitgrid_row(grid, grid->paper, grid->height - 1);
+}
+
+size_t bitgrid_count(bitgrid_t* grid, uint64_t* plane) {
+    size_t total = 0;
+    size_t n = bitgrid_plane_words(grid, grid->height);
+    for (size_t i = 0; i < n; i++) {
+        total += __builtin_popcountll(plane[i]);
+    }
+    return total;
+}
+
+int bitgrid_count_adjacent(bitgrid_t* grid, size_t row, size_t col) {
+    int adj_has_paper = 0;
+    for (ptrdiff_t i = (ptrdiff_t)row - 1; i <= (ptrdiff_t)row + 1; i++) {
+        for (ptrdiff_t j = (ptrdiff_t)col - 1; j <= (ptrdiff_t)col + 1; j++) {
+            adj_has_paper += bitgrid_get(grid, grid->paper, i, j);
+        }
+    }
+    return adj_has_paper - bitgrid_get(grid, grid->paper, row, col);
+}
+
+// Test grid of width x height cells, each a roll with percent% chance.
+bitgrid_t* random_bitgrid(size_t width, size_t height, int percent) {
+    bitgrid_t* grid = bitgrid_create(width, 4);
+    for (size_t row = 0; row < height; row++) {
+        bitgrid_add_row(grid);
+        for (size_t col = 0; col < width; col++) {
+            if (rand() % 100 < percent)
+                bitgrid_set(grid, grid->paper, row, col);
+        }
+    }
+    return grid;
+}
+
+// Writes the paper plane as an input file, every row ending in ending.
+void bitgrid_write(bitgrid_t* grid, FILE* file, const char* ending) {
+    for (size_t row = 0; row < grid->height; row++) {
+        for (size_t col = 0; col < grid->width; col++) {
+            fputc(bitgrid_get(grid, grid->paper, row, col) ? '@' : '.', file);
+        }
+        fputs(ending, file);
+    }
+}
+
+void test_bitgrid() {
+    bitgrid_t* grid = bitgrid_create(70, 1);
+    assert(grid->words >= 2 && grid->words % LANES == 0);
+    assert(grid->stride == grid->words + 2);
+    for (size_t i = 0; i < 3; i++) {
+        bitgrid_add_row(grid);
+    }
+    assert(grid->height == 3 && grid->cap >= 3);
+    assert(bitgrid_count(grid, grid->paper) == 0);
+
+    bitgrid_set(grid, grid->paper, 1, 63);
+    bitgrid_set(grid, grid->paper, 1, 64);
+    bitgrid_set(grid, grid->paper, 2, 69);
+    assert(bitgrid_get(grid, grid->paper, 1, 63));
+    assert(bitgrid_get(grid, grid->paper, 1, 64));
+    assert(!bitgrid_get(grid, grid->paper, 0, 64));
+    assert(!bitgrid_get(grid, grid->accessible, 1, 63));
+    assert(bitgrid_count(grid, grid->paper) == 3);
+
+    // neighbors across the word boundary, but never across rows.
+    assert(bitgrid_count_adjacent(grid, 1, 63) == 1);
+    assert(bitgrid_count_adjacent(grid, 2, 64) == 2);
+    assert(bitgrid_count_adjacent(grid, 2, 67) == 0);
+    assert(bitgrid_count_adjacent(grid, 0, 0) == 0);
+    // the border reads as empty.
+    assert(!bitgrid_get(grid, grid->paper, -1, 63));
+    assert(!bitgrid_get(grid, grid->paper, 3, 64));
+    assert(!bitgrid_get(grid, grid->paper, 1, -1));
+    assert(!bitgrid_get(grid, grid->paper, 2, 70));
+
+    bitgrid_unset(grid, grid->paper, 1, 63);
+    assert(!bitgrid_get(grid, grid->paper, 1, 63));
+    assert(bitgrid_count(grid, grid->paper) == 2);
+    bitgrid_destroy(grid);
+
+    printf("test_bitgrid passed.\n");
+}
+
+/* Bit-sliced neighbor counting.
+ * Each of the 8 neighbors of a row of cells is the row above, the row
+ * itself or the row below, shifted one column left, right or not at all.
+ * Adding those 8 bit vectors with full adders counts the neighbors of 64
+ * cells per word at once, with no per-cell branches. Only "fewer than 4"
+ * matters, so the adders stop once they know whether the 4s or 8s bit
+ * would be set.
+ *
+ * lanes_t holds LANES consecutive words of a row. Built with -mavx2 (or
+ * -march=native) that is one 256-bit register, so each operation covers
+ * 256 cells. Without it the compiler falls back to SSE2 or plain words.
+ * */
+#define FULL_ADD(sum, carry, a, b, c) do { \
+    lanes_t _ab = (a) ^ (b);               \
+    (sum) = _ab ^ (c);                     \
+    (carry) = ((a) & (b)) | (_ab & (c));   \
+} while (0)
+
+// Cells of `mid` that have fewer than 4 set neighbors. Each row is given as
+// (word to the left, words, word to the right) so the column shifts can
+// carry bits across word boundaries.
+static inline lanes_t lanes_lt4(lanes_t up_prev, lanes_t up, lanes_t up_next,
+                                lanes_t mid_prev, lanes_t mid, lanes_t mid_next,
+                                lanes_t down_prev, lanes_t down, lanes_t down_next) {
+    // column j - 1 lands on bit j, column j + 1 lands on bit j.
+    lanes_t ul = (up << 1) | (up_prev >> 63);
+    lanes_t ur = (up >> 1) | (up_next << 63);
+    lanes_t l  = (mid << 1) | (mid_prev >> 63);
+    lanes_t r  = (mid >> 1) | (mid_next << 63);
+    lanes_t dl = (down << 1) | (down_prev >> 63);
+    lanes_t dr = (down >> 1) | (down_next << 63);
+
+    lanes_t ones_a, twos_a, ones_b, twos_b, ones_c, twos_c, ones, twos_d;
+    FULL_ADD(ones_a, twos_a, ul, up, ur);
+    FULL_ADD(ones_b, twos_b, l, r, dl);
+    ones_c = down ^ dr;
+    twos_c = down & dr;
+    FULL_ADD(ones, twos_d, ones_a, ones_b, ones_c);
+    (void)ones;
+
+    // four weight-2 carries; any carry out of them means the count is >= 4.
+    lanes_t twos_e, fours_a;
+    FULL_ADD(twos_e, fours_a, twos_a, twos_b, twos_c);
+    lanes_t fours_b = twos_e & twos_d;
+    return mid & ~(fours_a | fours_b);
+}
+
+/* out = cells of `mid` with fewer than 4 neighbors in up/mid/down.
+ * All three rows are bitgrid rows, so the words either side of them are
+ * the zero guard words and the loads never need a bounds check.
+ * */
+void row_lt4_mask(const uint64_t* up, const uint64_t* mid, const uint64_t* down,
+                  uint64_t* out, size_t words) {
+    for (size_t w = 0; w < words; w += LANES) {
+        lanes_t v[9];
+        memcpy(&v[0], up + w - 1, sizeof(lanes_t));
+        memcpy(&v[1], up + w, sizeof(lanes_t));
+        memcpy(&v[2], up + w + 1, sizeof(lanes_t));
+        memcpy(&v[3], mid + w - 1, sizeof(lanes_t));
+        memcpy(&v[4], mid + w, sizeof(lanes_t));
+        memcpy(&v[5], mid + w + 1, sizeof(lanes_t));
+        memcpy(&v[6], down + w - 1, sizeof(lanes_t));
+        memcpy(&v[7], down + w, sizeof(lanes_t));
+        memcpy(&v[8], down + w + 1, sizeof(lanes_t));
+        lanes_t mask = lanes_lt4(v[0], v[1], v[2], v[3], v[4], v[5], v[6], v[7], v[8]);
+        memcpy(out + w, &mask, sizeof(lanes_t));
+    }
+}
 
-    grid_node_t* node = &grid->nodes[grid->n++];
-    node->val = val;
-    node->n = 0;
-    node->adj = (grid_node_t**)malloc(sizeof(grid_node_t*) * DEFAULT_NODE_CAP);
-    node->cap = DEFAULT_NODE_CAP;
-    return node;
+// Marks every roll with fewer than 4 neighboring rolls in grid->accessible.
+void mark_accessible(bitgrid_t* grid) {
+    for (size_t row = 0; row < grid->height; row++) {
+        row_lt4_mask(bitgrid_row(grid, grid->paper, (ptrdiff_t)row - 1),
+                     bitgrid_row(grid, grid->paper, row),
+                     bitgrid_row(grid, grid->paper, row + 1),
+                     bitgrid_row(grid, grid->accessible, row), grid->words);
+    }
 }
 
-void grid_node_add_adj(grid_node_t* node, grid_node_t* adj) {
-    if (node->n >= node->cap) {
-        size_t new_cap = node->cap * 2;
-        node->adj = (grid_node_t**)realloc(node->adj, new_cap * sizeof(grid_node_t*));
-        node->cap = new_cap;
+void test_kernel() {
+    // widths either side of a word and lane boundary.
+    size_t widths[] = { 1, 63, 64, 65, 200, 257 };
+    srand(4);
+    for (size_t k = 0; k < sizeof(widths) / sizeof(widths[0]); k++) {
+        bitgrid_t* grid = random_bitgrid(widths[k], 9, 75);
+
+        mark_accessible(grid);
+        for (size_t row = 0; row < grid->height; row++) {
+            for (size_t col = 0; col < grid->width; col++) {
+                bool expected = bitgrid_get(grid, grid->paper, row, col)
+                    && bitgrid_count_adjacent(grid, row, col) < 4;
+                assert(bitgrid_get(grid, grid->accessible, row, col) == expected);
+            }
+        }
+        bitgrid_destroy(grid);
     }
-    node->adj[node->n++] = adj;
+
+    printf("test_kernel passed.\n");
 }
 
+/* Per-round part 2 telemetry, enabled with --telemetry=csv|json and
+ * written to stderr so the answers on stdout stay as they are.
+ * The engines only ever touch it through `if (telemetry)` once per round
+ * (or once per run), and every figure is derived from counts the engine
+ * keeps anyway, so with the flag off there is no per-cell cost at all.
+ *
+ * examined - cells the round looked at: the whole grid for the round
+ *            based engines, 8 neighbors per removed roll for the worklists.
+ * removed  - rolls removed this round.
+ * frontier - rolls known to be removable at the start of the round.
+ * */
+typedef enum {
+    TELEMETRY_CSV,
+    TELEMETRY_JSON,
+} telemetry_format_t;
+
+typedef struct {
+    telemetry_format_t format;
+    FILE* out;
+    const char* engine;
+    size_t rows;
+} telemetry_t;
+
+static telemetry_t* telemetry = NULL;
 
-void grid_node_set_flags(grid_node_t* node, int flags) {
-    node->val |= flags;
+double seconds_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+void telemetry_begin(telemetry_t* tm, const char* engine) {
+    tm->engine = engine;
+    tm->rows = 0;
+    if (tm->format == TELEMETRY_CSV)
+        fprintf(tm->out, "engine,round,seconds,examined,removed,frontier\n");
+    else
+        fprintf(tm->out, "{\"engine\": \"%s\", \"rounds\": [", engine);
+}
+
+void telemetry_round(telemetry_t* tm, size_t round, double seconds,
+                     size_t examined, size_t removed, size_t frontier) {
+    if (tm->format == TELEMETRY_CSV) {
+        fprintf(tm->out, "%s,%zu,%.9f,%zu,%zu,%zu\n",
+                tm->engine, round, seconds, examined, removed, frontier);
+    } else {
+        fprintf(tm->out, "%s\n  {\"round\": %zu, \"seconds\": %.9f, \"examined\": %zu, "
+                "\"removed\": %zu, \"frontier\": %zu}",
+                tm->rows > 0 ? "," : "", round, seconds, examined, removed, frontier);
+    }
+    tm->rows++;
 }
 
-void grid_node_unset_flags(grid_node_t* node, int flags) {
-    node->val &= !flags;
+void telemetry_end(telemetry_t* tm) {
+    if (tm->format == TELEMETRY_JSON)
+        fprintf(tm->out, "\n]}\n");
+    fflush(tm->out);
 }
 
-void grid_node_set_accessible(grid_node_t* node) {
-    grid_node_set_flags(node, NODE_ACCESSIBLE);
+size_t execute_part1(bitgrid_t* grid) {
+    mark_accessible(grid);
+    size_t num_accessible = bitgrid_count(grid, grid->accessible);
+    printf("Part 1 answer: %zu\n", num_accessible);
+    return num_accessible;
 }
 
-bool grid_node_has_flags(grid_node_t* node, int flags) {
-    return (node->val & flags) == flags;
+// execute_part2's rounds; `report` prints each round's removals.
+size_t peel_rounds(bitgrid_t* grid, bool report) {
+    size_t total_changed = 0;
+    size_t num_changed = 0xFF; // some default?
+                               //
+    size_t round = 0;
+    double start = telemetry ? seconds_now() : 0;
+    while (num_changed > 0) {
+        mark_accessible(grid);
+        num_changed = 0;
+        for (size_t i = 0; i < bitgrid_plane_words(grid, grid->height); i++) {
+            num_changed += __builtin_popcountll(grid->accessible[i]);
+            grid->paper[i] &= ~grid->accessible[i];
+        }
+        total_changed += num_changed;
+        if (report)
+            printf("%zu (%zu).\n", num_changed, total_changed);
+        if (report && telemetry) {
+            double now = seconds_now();
+            telemetry_round(telemetry, ++round, now - start, bitgrid_cells(grid), num_changed, num_changed);
+            start = now;
+        }
+    }
+    return total_changed;
 }
 
-bool grid_node_is_accessible(grid_node_t* node) {
-    return grid_node_has_flags(node, NODE_ACCESSIBLE);
+size_t execute_part2(bitgrid_t* grid) {
+    return peel_rounds(grid, true);
 }
 
-bool grid_node_has_paper(grid_node_t* node) {
-    return grid_node_has_flags(node, NODE_PAPER);
+/* Part 2 as a worklist instead of rounds.
+ * Every roll's neighbor count is computed once. Rolls under 4 go on a
+ * queue; removing one only decrements its 8 neighbors, and a neighbor is
+ * queued the moment its count drops from 4 to 3, so each roll is queued
+ * at most once. O(cells) total instead of O(cells * rounds).
+ *
+ * Removal order doesn't change which rolls end up removed, so the total
+ * matches execute_part2's total_changed.
+ * */
+#define NO_ROLL 0xFF
+
+size_t execute_part2_worklist(bitgrid_t* grid) {
+    // counts get the same one-cell border as the bitgrid, so the 8
+    // neighbors of any cell are fixed offsets with no bounds checks. The
+    // border, empty cells and removed rolls all hold NO_ROLL.
+    size_t cw = grid->width + 2;
+    size_t cells = cw * (grid->height + 2);
+    uint8_t* counts = (uint8_t*)malloc(cells);
+    memset(counts, NO_ROLL, cells);
+    size_t* queue = (size_t*)malloc(sizeof(size_t) * (bitgrid_count(grid, grid->paper) + 1));
+    size_t head = 0;
+    size_t tail = 0;
+    const ptrdiff_t offsets[8] = {
+        -(ptrdiff_t)cw - 1, -(ptrdiff_t)cw, -(ptrdiff_t)cw + 1,
+        -1, 1,
+        (ptrdiff_t)cw - 1, (ptrdiff_t)cw, (ptrdiff_t)cw + 1,
+    };
+
+    double start = telemetry ? seconds_now() : 0;
+    for (size_t row = 0; row < grid->height; row++) {
+        for (size_t col = 0; col < grid->width; col++) {
+            if (!bitgrid_get(grid, grid->paper, row, col))
+                continue;
+            size_t idx = (row + 1) * cw + col + 1;
+            counts[idx] = bitgrid_count_adjacent(grid, row, col);
+            if (counts[idx] < 4)
+                queue[tail++] = idx;
+        }
+    }
+
+    if (telemetry) {
+        double now = seconds_now();
+        telemetry_round(telemetry, 0, now - start, bitgrid_cells(grid), 0, tail);
+        start = now;
+    }
+
+    // the queue is FIFO, so a round is everything the previous round
+    // queued; round 0 above is the initial scan.
+    size_t round = 0;
+    while (head < tail) {
+        size_t round_end = tail;
+        size_t frontier = round_end - head;
+        while (head < round_end) {
+            size_t idx = queue[head++];
+            counts[idx] = NO_ROLL;
+            bitgrid_unset(grid, grid->paper, idx / cw - 1, idx % cw - 1);
+
+            for (int k = 0; k < 8; k++) {
+                size_t adj = idx + offsets[k];
+                uint8_t count = counts[adj];
+                if (count == NO_ROLL)
+                    continue;
+                // still-queued rolls are below 4 already and can't hit this again.
+                counts[adj] = count - 1;
+                if (count == 4)
+                    queue[tail++] = adj;
+            }
+        }
+        if (telemetry) {
+            double now = seconds_now();
+            telemetry_round(telemetry, ++round, now - start, 8 * frontier, frontier, frontier);
+            start = now;
+        }
+    }
+
+    free(counts);
+    free(queue);
+    return tail;
 }
 
-void test_grid() {
-    size_t len = 9;
-    grid_t* grid = grid_create(3, len);
-    for (size_t i = 0; i < len; i++) {
-        grid_add_node(grid, NODE_PAPER);
+void test_worklist() {
+    srand(29);
+    for (int k = 0; k < 8; k++) {
+        bitgrid_t* grid = random_bitgrid(20 + k * 17, 30, 70);
+        bitgrid_t* copy = bitgrid_copy(grid);
+
+        size_t total_changed = peel_rounds(grid, false);
+        assert(execute_part2_worklist(copy) == total_changed);
+        // both leave the same rolls behind.
+        assert(bitgrid_equal(grid, grid->paper, copy, copy->paper));
+        bitgrid_destroy(grid);
+        bitgrid_destroy(copy);
     }
-    assert(grid->n == len);
-    assert(grid_node_has_flags(grid->nodes, NODE_PAPER));
-    grid_node_set_accessible(grid->nodes);
-    assert(grid_node_has_flags(grid->nodes, NODE_ACCESSIBLE));
-    assert(grid_node_has_flags(grid->nodes, NODE_ACCESSIBLE | NODE_PAPER));
-    assert(!grid_node_has_flags(grid->nodes + 1, NODE_ACCESSIBLE));
-    assert(!grid_node_has_flags(grid->nodes + 1, NODE_ACCESSIBLE | NODE_PAPER));
-    grid_node_unset_flags(grid->nodes, NODE_ACCESSIBLE);
-    assert(!grid_node_has_flags(grid->nodes, NODE_ACCESSIBLE));
 
-    printf("test_grid passed.\n");
+    printf("test_worklist passed.\n");
 }
 
-void execute_part1(grid_t* grid) {
-    for (size_t idx = 0; idx < grid->n; idx++) {
-        int row = idx / grid->stride;
-        int col = idx % grid->stride;
+/* Row-band parallel engine.
+ * The grid is cut into horizontal bands, one per thread. A band reads the
+ * row just above and below it (its halo) straight out of the shared source
+ * plane, which nobody writes during a pass, and writes only its own rows of
+ * the destination plane. For part 2 every round ends at a barrier where one
+ * thread totals the removals and swaps source and destination, then a
+ * second barrier releases everyone into the next round.
+ *
+ * Build with -pthread.
+ * */
+typedef struct {
+    bitgrid_t* grid;
+    uint64_t* src;
+    uint64_t* dst;
+    pthread_barrier_t barrier;
+    size_t num_bands;
+    size_t* band_changed;
+    size_t total_changed;
+    bool peel; // part 2: dst = src minus accessible, repeat until stable.
+    bool report; // print each round like execute_part2 does.
+    bool done;
+    size_t round;
+    double round_start; // for telemetry
 
-        grid_node_t* node = &grid->nodes[idx];
-        int adj_has_paper = 0;
-        for (int i = row - 1; i <= row + 1; i++) {
-            for (int j = col - 1; j <= col + 1; j++) {
-                if (i < 0 || j < 0) continue;
+} band_ctx_t;
 
-                size_t index = (i * grid->stride) + j;
-                if (index > grid->n - 1 || index == idx) continue;
-                
-                grid_node_t* adj = &grid->nodes[index];
-                if (grid_node_has_paper(adj)) {
-                    adj_has_paper += 1;
-                }
+typedef struct {
+    band_ctx_t* ctx;
+    size_t id;
+    size_t row_begin;
+    size_t row_end;
+} band_t;
+
+size_t band_pass(band_ctx_t* ctx, band_t* band) {
+    bitgrid_t* grid = ctx->grid;
+    size_t changed = 0;
+    for (size_t row = band->row_begin; row < band->row_end; row++) {
+        const uint64_t* up = bitgrid_row(grid, ctx->src, (ptrdiff_t)row - 1);
+        const uint64_t* down = bitgrid_row(grid, ctx->src, row + 1);
+        const uint64_t* mid = bitgrid_row(grid, ctx->src, row);
+        uint64_t* out = bitgrid_row(grid, ctx->dst, row);
+        row_lt4_mask(up, mid, down, out, grid->words);
+        for (size_t w = 0; w < grid->words; w++) {
+            changed += __builtin_popcountll(out[w]);
+            if (ctx->peel)
+                out[w] = mid[w] & ~out[w];
+        }
+    }
+    return changed;
+}
+
+void* band_worker(void* arg) {
+    band_t* band = (band_t*)arg;
+    band_ctx_t* ctx = band->ctx;
+    while (true) {
+        ctx->band_changed[band->id] = band_pass(ctx, band);
+        if (!ctx->peel)
+            return NULL;
+
+        if (pthread_barrier_wait(&ctx->barrier) == PTHREAD_BARRIER_SERIAL_THREAD) {
+            size_t num_changed = 0;
+            for (size_t i = 0; i < ctx->num_bands; i++) {
+                num_changed += ctx->band_changed[i];
+            }
+            ctx->total_changed += num_changed;
+            if (ctx->report)
+                printf("%zu (%zu).\n", num_changed, ctx->total_changed);
+            if (ctx->report && telemetry) {
+                double now = seconds_now();
+                telemetry_round(telemetry, ++ctx->round, now - ctx->round_start,
+                                bitgrid_cells(ctx->grid), num_changed, num_changed);
+                ctx->round_start = now;
             }
+            uint64_t* tmp = ctx->src;
+            ctx->src = ctx->dst;
+            ctx->dst = tmp;
+            ctx->done = num_changed == 0;
+        }
+        pthread_barrier_wait(&ctx->barrier);
+        if (ctx->done)
+            return NULL;
+    }
+}
+
+size_t run_bands(bitgrid_t* grid, size_t num_threads, bool peel, bool report) {
+    if (num_threads > grid->height)
+        num_threads = grid->height;
+    if (num_threads == 0)
+        num_threads = 1;
+
+    band_ctx_t ctx = {
+        .grid = grid,
+        .src = grid->paper,
+        .dst = grid->accessible,
+        .num_bands = num_threads,
+        .band_changed = (size_t*)calloc(num_threads, sizeof(size_t)),
+        .total_changed = 0,
+        .peel = peel,
+        .report = report,
+        .done = false,
+        .round = 0,
+        .round_start = telemetry ? seconds_now() : 0,
+    };
+    pthread_barrier_init(&ctx.barrier, NULL, num_threads);
+
+    pthread_t* threads = (pthread_t*)malloc(sizeof(pthread_t) * num_threads);
+    band_t* bands = (band_t*)malloc(sizeof(band_t) * num_threads);
+    for (size_t i = 0; i < num_threads; i++) {
+        bands[i] = (band_t){
+            .ctx = &ctx,
+            .id = i,
+            .row_begin = grid->height * i / num_threads,
+            .row_end = grid->height * (i + 1) / num_threads,
+        };
+        pthread_create(&threads[i], NULL, band_worker, &bands[i]);
+    }
+    for (size_t i = 0; i < num_threads; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    size_t result = ctx.total_changed;
+    if (peel) {
+        // the final state is in src, which may be either plane now.
+        grid->paper = ctx.src;
+        grid->accessible = ctx.dst;
+    } else {
+        for (size_t i = 0; i < num_threads; i++) {
+            result += ctx.band_changed[i];
+        }
+    }
+
+    pthread_barrier_destroy(&ctx.barrier);
+    free(ctx.band_changed);
+    free(threads);
+    free(bands);
+    return result;
+}
+
+size_t execute_part1_bands(bitgrid_t* grid, size_t num_threads) {
+    size_t num_accessible = run_bands(grid, num_threads, false, false);
+    printf("Part 1 answer: %zu\n", num_accessible);
+    return num_accessible;
+}
+
+size_t execute_part2_bands(bitgrid_t* grid, size_t num_threads) {
+    return run_bands(grid, num_threads, true, true);
+}
+
+void test_bands() {
+    srand(30);
+    for (size_t threads = 1; threads <= 5; threads++) {
+        bitgrid_t* grid = random_bitgrid(150, 41, 70);
+        bitgrid_t* copy = bitgrid_copy(grid);
+
+        mark_accessible(copy);
+        assert(run_bands(grid, threads, false, false) == bitgrid_count(copy, copy->accessible));
+        assert(run_bands(grid, threads, true, false) == execute_part2_worklist(copy));
+        assert(bitgrid_equal(grid, grid->paper, copy, copy->paper));
+        bitgrid_destroy(grid);
+        bitgrid_destroy(copy);
+    }
+
+    printf("test_bands passed.\n");
+}
+
+/* Tiled storage.
+ * With very wide rows the rows above and below a word are `words` apart,
+ * so a pass streams three far-apart rows through the cache. A tilegrid
+ * instead stores the grid as 64x64-cell tiles, one word per tile row, so
+ * everything a tile's stencil reads is a few contiguous blocks.
+ *
+ * Each tile also carries a halo: a copy of the last row of the tile above
+ * in front of its own 64 rows and of the first row of the tile below after
+ * them. Tiles sit row-major with a zero guard tile at both ends of each
+ * tile row, so the tiles to the left and right, which supply the bits
+ * shifted in across the side edges, are always the neighboring blocks.
+ * The kernel then runs down a tile LANES rows at a time with no edge
+ * cases. Cells past the grid's width and height are stored as 0.
+ *
+ * The halos are copies, so whenever tiles change (each part 2 round)
+ * tilegrid_exchange_halos refreshes them, 2 words per tile.
+ * */
+#define TILE_ROWS 64
+#define HALO_ROWS (TILE_ROWS + 2)
+
+typedef struct {
+    size_t width;
+    size_t height;
+    size_t tiles_x;
+    size_t tiles_y;
+    uint64_t* paper;
+    uint64_t* scratch; // second plane for part 2 rounds
+} tilegrid_t;
+
+// Word 0 is the halo above, words 1..64 the tile's rows, word 65 the halo
+// below. tx == -1 and tx == tiles_x are the guard tiles.
+uint64_t* tilegrid_tile(tilegrid_t* tiles, uint64_t* plane, size_t ty, ptrdiff_t tx) {
+    return plane + (ty * (tiles->tiles_x + 2) + (size_t)(tx + 1)) * HALO_ROWS;
+}
+
+void tilegrid_exchange_halos(tilegrid_t* tiles, uint64_t* plane) {
+    for (size_t ty = 0; ty < tiles->tiles_y; ty++) {
+        for (size_t tx = 0; tx < tiles->tiles_x; tx++) {
+            uint64_t* tile = tilegrid_tile(tiles, plane, ty, tx);
+            tile[0] = ty > 0 ? tilegrid_tile(tiles, plane, ty - 1, tx)[TILE_ROWS] : 0;
+            tile[HALO_ROWS - 1] = ty + 1 < tiles->tiles_y ? tilegrid_tile(tiles, plane, ty + 1, tx)[1] : 0;
+        }
+    }
+}
+
+tilegrid_t* tilegrid_from_bitgrid(bitgrid_t* grid) {
+    tilegrid_t* tiles = (tilegrid_t*)malloc(sizeof(tilegrid_t));
+    tiles->width = grid->width;
+    tiles->height = grid->height;
+    tiles->tiles_x = (grid->width + WORD_BITS - 1) / WORD_BITS;
+    tiles->tiles_y = (grid->height + TILE_ROWS - 1) / TILE_ROWS;
+    size_t n = tiles->tiles_y * (tiles->tiles_x + 2) * HALO_ROWS;
+    tiles->paper = (uint64_t*)calloc(n, sizeof(uint64_t));
+    tiles->scratch = (uint64_t*)calloc(n, sizeof(uint64_t));
+    for (size_t row = 0; row < grid->height; row++) {
+        const uint64_t* src = bitgrid_row(grid, grid->paper, row);
+        for (size_t tx = 0; tx < tiles->tiles_x; tx++) {
+            tilegrid_tile(tiles, tiles->paper, row / TILE_ROWS, tx)[row % TILE_ROWS + 1] = src[tx];
+        }
+    }
+    tilegrid_exchange_halos(tiles, tiles->paper);
+    return tiles;
+}
+
+void tilegrid_to_bitgrid(tilegrid_t* tiles, bitgrid_t* grid) {
+    for (size_t row = 0; row < grid->height; row++) {
+        uint64_t* dst = bitgrid_row(grid, grid->paper, row);
+        for (size_t tx = 0; tx < tiles->tiles_x; tx++) {
+            dst[tx] = tilegrid_tile(tiles, tiles->paper, row / TILE_ROWS, tx)[row % TILE_ROWS + 1];
         }
+    }
+}
+
+void tilegrid_destroy(tilegrid_t* tiles) {
+    free(tiles->paper);
+    free(tiles->scratch);
+    free(tiles);
+}
 
-        if (adj_has_paper < 4) {
-            grid_node_set_accessible(node);
+// out[r] = cells of tile row r with fewer than 4 neighbors.
+void tile_lt4_mask(const uint64_t* tile, uint64_t out[TILE_ROWS]) {
+    const uint64_t* left = tile - HALO_ROWS;
+    const uint64_t* right = tile + HALO_ROWS;
+    for (size_t r = 0; r < TILE_ROWS; r += LANES) {
+        lanes_t v[9];
+        for (int dr = 0; dr < 3; dr++) {
+            memcpy(&v[dr * 3 + 0], left + r + dr, sizeof(lanes_t));
+            memcpy(&v[dr * 3 + 1], tile + r + dr, sizeof(lanes_t));
+            memcpy(&v[dr * 3 + 2], right + r + dr, sizeof(lanes_t));
         }
+        lanes_t mask = lanes_lt4(v[0], v[1], v[2], v[3], v[4], v[5], v[6], v[7], v[8]);
+        memcpy(out + r, &mask, sizeof(lanes_t));
     }
+}
 
-    int num_accessible = 0;
-    for (size_t i = 0; i < grid->n; i++) {
-        if (grid_node_has_flags(grid->nodes + i, NODE_PAPER | NODE_ACCESSIBLE))
-            num_accessible += 1;
+size_t tilegrid_count_accessible(tilegrid_t* tiles) {
+    uint64_t mask[TILE_ROWS];
+    size_t num_accessible = 0;
+    for (size_t ty = 0; ty < tiles->tiles_y; ty++) {
+        for (size_t tx = 0; tx < tiles->tiles_x; tx++) {
+            tile_lt4_mask(tilegrid_tile(tiles, tiles->paper, ty, tx), mask);
+            for (size_t r = 0; r < TILE_ROWS; r++) {
+                num_accessible += __builtin_popcountll(mask[r]);
+            }
+        }
     }
-    printf("Part 1 answer: %i\n", num_accessible);
+    return num_accessible;
 }
 
-void execute_part2(grid_t* grid) {
-    int total_changed = 0;
-    int num_changed = 0xFF; // some default?
-                            //
+// Part 2 rounds, tile by tile. Each round reads `paper` and writes
+// `scratch`, then the two swap, so no tile sees a neighbor's update early.
+size_t tilegrid_peel_rounds(tilegrid_t* tiles) {
+    uint64_t mask[TILE_ROWS];
+    size_t total_changed = 0;
+    size_t num_changed = 1;
     while (num_changed > 0) {
         num_changed = 0;
-        for (size_t node_idx = 0; node_idx < grid_len(grid); node_idx++) {
-            int row = node_idx / grid->stride;
-            int col = node_idx % grid->stride;
+        for (size_t ty = 0; ty < tiles->tiles_y; ty++) {
+            for (size_t tx = 0; tx < tiles->tiles_x; tx++) {
+                const uint64_t* src = tilegrid_tile(tiles, tiles->paper, ty, tx);
+                uint64_t* dst = tilegrid_tile(tiles, tiles->scratch, ty, tx);
+                tile_lt4_mask(src, mask);
+                for (size_t r = 0; r < TILE_ROWS; r++) {
+                    num_changed += __builtin_popcountll(mask[r]);
+                    dst[r + 1] = src[r + 1] & ~mask[r];
+                }
+            }
+        }
+        tilegrid_exchange_halos(tiles, tiles->scratch);
+        uint64_t* tmp = tiles->paper;
+        tiles->paper = tiles->scratch;
+        tiles->scratch = tmp;
+        total_changed += num_changed;
+    }
+    return total_changed;
+}
+
+void test_tiles() {
+    srand(37);
+    size_t sizes[][2] = { { 64, 64 }, { 65, 130 }, { 200, 70 }, { 3, 200 } };
+    for (size_t k = 0; k < sizeof(sizes) / sizeof(sizes[0]); k++) {
+        bitgrid_t* grid = random_bitgrid(sizes[k][0], sizes[k][1], 70);
+        tilegrid_t* tiles = tilegrid_from_bitgrid(grid);
+        bitgrid_t* copy = bitgrid_copy(grid);
+        tilegrid_to_bitgrid(tiles, copy);
+        assert(bitgrid_equal(grid, grid->paper, copy, copy->paper));
+
+        mark_accessible(grid);
+        assert(tilegrid_count_accessible(tiles) == bitgrid_count(grid, grid->accessible));
+        assert(tilegrid_peel_rounds(tiles) == peel_rounds(grid, false));
+        tilegrid_to_bitgrid(tiles, copy);
+        assert(bitgrid_equal(grid, grid->paper, copy, copy->paper));
+
+        tilegrid_destroy(tiles);
+        bitgrid_destroy(grid);
+        bitgrid_destroy(copy);
+    }
+
+    printf("test_tiles passed.\n");
+}
+
+/* Hardware cache counters for the tile benchmark, through perf_event_open.
+ * Not every machine (or VM, or container) exposes them; perf_counter_open
+ * returns -1 then and the benchmark prints "n/a".
+ * */
+int perf_counter_open(uint32_t type, uint64_t config) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+void perf_counter_start(int fd) {
+    if (fd < 0)
+        return;
+    ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+    ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+}
+
+// -1 when the counter isn't available.
+int64_t perf_counter_stop(int fd) {
+    if (fd < 0)
+        return -1;
+    ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+    uint64_t value = 0;
+    if (read(fd, &value, sizeof(value)) != sizeof(value))
+        return -1;
+    return (int64_t)value;
+}
+
+typedef struct {
+    double seconds;
+    int64_t l1d_misses;
+    int64_t cache_misses;
+} tile_bench_t;
+
+void print_tile_bench(const char* layout, const char* pass, size_t cells, tile_bench_t* b) {
+    printf("%s,%s,%.3f,%.1f,", layout, pass, b->seconds * 1e3, (double)cells / b->seconds * 1e-6);
+    if (b->l1d_misses >= 0) printf("%lld,", (long long)b->l1d_misses); else printf("n/a,");
+    if (b->cache_misses >= 0) printf("%lld\n", (long long)b->cache_misses); else printf("n/a\n");
+}
+
+void print_tile_ratio(const char* pass, tile_bench_t* rows, tile_bench_t* tiles) {
+    printf("# %s: tiles run %.2fx the throughput of rows", pass, rows->seconds / tiles->seconds);
+    if (rows->l1d_misses > 0 && tiles->l1d_misses >= 0)
+        printf(", L1D misses %+.1f%%", 100.0 * (tiles->l1d_misses - rows->l1d_misses) / rows->l1d_misses);
+    if (rows->cache_misses > 0 && tiles->cache_misses >= 0)
+        printf(", cache misses %+.1f%%", 100.0 * (tiles->cache_misses - rows->cache_misses) / rows->cache_misses);
+    printf("\n");
+}
+
+/* --bench-tiles: part 1 and part 2 rounds on the row layout and the tile
+ * layout, as CSV with the cache counters beside the throughput, plus a
+ * summary of the gain and the change in misses.
+ * */
+void bench_tiles(bitgrid_t* grid) {
+    int l1d = perf_counter_open(PERF_TYPE_HW_CACHE,
+            PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16));
+    int llc = perf_counter_open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+    size_t cells = bitgrid_cells(grid);
+    tile_bench_t rows1, rows2, tiles1, tiles2;
+    size_t expected1, expected2;
+
+    bitgrid_t* copy = bitgrid_copy(grid);
+    tilegrid_t* tiles = tilegrid_from_bitgrid(grid);
+
+#define BENCH_RUN(out, expr) do {                  \
+        perf_counter_start(l1d);                   \
+        perf_counter_start(llc);                   \
+        double start = seconds_now();              \
+        expr;                                      \
+        (out).seconds = seconds_now() - start;     \
+        (out).l1d_misses = perf_counter_stop(l1d); \
+        (out).cache_misses = perf_counter_stop(llc); \
+    } while (0)
+
+    BENCH_RUN(rows1, mark_accessible(copy); expected1 = bitgrid_count(copy, copy->accessible));
+    BENCH_RUN(rows2, expected2 = peel_rounds(copy, false));
+    size_t got1 = 0, got2 = 0;
+    BENCH_RUN(tiles1, got1 = tilegrid_count_accessible(tiles));
+    BENCH_RUN(tiles2, got2 = tilegrid_peel_rounds(tiles));
+#undef BENCH_RUN
+    assert(got1 == expected1 && got2 == expected2);
+
+    printf("layout,pass,ms,mcells_per_sec,l1d_read_misses,cache_misses\n");
+    print_tile_bench("rows", "part1", cells, &rows1);
+    print_tile_bench("tiles", "part1", cells, &tiles1);
+    print_tile_bench("rows", "part2", cells, &rows2);
+    print_tile_bench("tiles", "part2", cells, &tiles2);
+    print_tile_ratio("part1", &rows1, &tiles1);
+    print_tile_ratio("part2", &rows2, &tiles2);
+
+    if (l1d >= 0) close(l1d);
+    if (llc >= 0) close(llc);
+    tilegrid_destroy(tiles);
+    bitgrid_destroy(copy);
+}
+
+/* Generalized rule: a roll is accessible when fewer than `threshold`
+ * rolls lie within `radius` cells of it (a (2r+1)^2 box, minus itself).
+ * radius 1 / threshold 4 is the puzzle's rule.
+ *
+ * Counting the box directly is O(r^2) per cell. Instead build a summed
+ * area table once per pass, sat[i][j] = rolls in rows < i and columns < j,
+ * and any box is 4 lookups. The table is uint32_t even for grids with more
+ * than 2^32 cells: the sums wrap, but the difference of the four corners
+ * is exact as long as the box itself holds fewer than 2^32 cells.
+ * */
+typedef struct {
+    size_t width;  // grid width + 1
+    size_t height; // grid height + 1
+    uint32_t* sums;
+} sat_t;
+
+sat_t* sat_create(bitgrid_t* grid) {
+    sat_t* sat = (sat_t*)malloc(sizeof(sat_t));
+    sat->width = grid->width + 1;
+    sat->height = grid->height + 1;
+    sat->sums = (uint32_t*)calloc(sat->width * sat->height, sizeof(uint32_t));
+    return sat;
+}
+
+void sat_destroy(sat_t* sat) {
+    free(sat->sums);
+    free(sat);
+}
 
-            grid_node_t* node = &grid->nodes[node_idx];
-            int adj_has_paper = 0;
+void sat_build(sat_t* sat, bitgrid_t* grid) {
+    for (size_t row = 0; row < grid->height; row++) {
+        const uint64_t* paper = bitgrid_row(grid, grid->paper, row);
+        const uint32_t* above = sat->sums + row * sat->width;
+        uint32_t* out = sat->sums + (row + 1) * sat->width;
+        uint32_t running = 0;
+        out[0] = 0;
+        for (size_t col = 0; col < grid->width; col++) {
+            running += (paper[col / WORD_BITS] >> (col % WORD_BITS)) & 1;
+            out[col + 1] = above[col + 1] + running;
+        }
+    }
+}
+
+// Rolls in rows [r0, r1) and columns [c0, c1).
+uint32_t sat_box(sat_t* sat, size_t r0, size_t c0, size_t r1, size_t c1) {
+    const uint32_t* top = sat->sums + r0 * sat->width;
+    const uint32_t* bottom = sat->sums + r1 * sat->width;
+    return bottom[c1] - bottom[c0] - top[c1] + top[c0];
+}
+
+void mark_accessible_radius(bitgrid_t* grid, sat_t* sat, size_t radius, size_t threshold) {
+    sat_build(sat, grid);
+    for (size_t row = 0; row < grid->height; row++) {
+        const uint64_t* paper = bitgrid_row(grid, grid->paper, row);
+        uint64_t* accessible = bitgrid_row(grid, grid->accessible, row);
+        memset(accessible, 0, grid->words * sizeof(uint64_t));
+        size_t r0 = row > radius ? row - radius : 0;
+        size_t r1 = row + radius + 1 < grid->height ? row + radius + 1 : grid->height;
+        for (size_t col = 0; col < grid->width; col++) {
+            uint64_t bit = (paper[col / WORD_BITS] >> (col % WORD_BITS)) & 1;
+            if (!bit)
+                continue;
+            size_t c0 = col > radius ? col - radius : 0;
+            size_t c1 = col + radius + 1 < grid->width ? col + radius + 1 : grid->width;
+            uint32_t adj_has_paper = sat_box(sat, r0, c0, r1, c1) - 1;
+            if (adj_has_paper < threshold)
+                accessible[col / WORD_BITS] |= bit << (col % WORD_BITS);
+        }
+    }
+}
+
+size_t execute_part1_radius(bitgrid_t* grid, size_t radius, size_t threshold) {
+    sat_t* sat = sat_create(grid);
+    mark_accessible_radius(grid, sat, radius, threshold);
+    sat_destroy(sat);
+    size_t num_accessible = bitgrid_count(grid, grid->accessible);
+    printf("Part 1 answer: %zu\n", num_accessible);
+    return num_accessible;
+}
 
-            for (int i = row - 1; i <= row + 1; i++) {
-                for (int j = col - 1; j <= col + 1; j++) {
-                    if (i < 0 || j < 0) continue;
+// execute_part2's rounds with the generalized rule.
+size_t execute_part2_radius(bitgrid_t* grid, size_t radius, size_t threshold) {
+    sat_t* sat = sat_create(grid);
+    size_t total_changed = 0;
+    size_t num_changed = 1;
+    size_t round = 0;
+    double start = telemetry ? seconds_now() : 0;
+    while (num_changed > 0) {
+        mark_accessible_radius(grid, sat, radius, threshold);
+        num_changed = 0;
+        for (size_t i = 0; i < bitgrid_plane_words(grid, grid->height); i++) {
+            num_changed += __builtin_popcountll(grid->accessible[i]);
+            grid->paper[i] &= ~grid->accessible[i];
+        }
+        total_changed += num_changed;
+        printf("%zu (%zu).\n", num_changed, total_changed);
+        if (telemetry) {
+            double now = seconds_now();
+            telemetry_round(telemetry, ++round, now - start, bitgrid_cells(grid), num_changed, num_changed);
+            start = now;
+        }
+    }
+    sat_destroy(sat);
+    return total_changed;
+}
+
+void test_radius() {
+    srand(36);
+    bitgrid_t* grid = random_bitgrid(90, 40, 60);
+    bitgrid_t* copy = bitgrid_copy(grid);
+    sat_t* sat = sat_create(grid);
 
-                    size_t index = (i * grid->stride) + j;
-                    if (index > grid->n - 1 || index == node_idx) continue;
+    // radius 1, threshold 4 is the stencil kernel's rule.
+    mark_accessible(copy);
+    mark_accessible_radius(grid, sat, 1, 4);
+    assert(bitgrid_equal(grid, grid->accessible, copy, copy->accessible));
 
-                    grid_node_t* adj = &grid->nodes[index];
-                    if (grid_node_has_paper(adj)) {
-                        adj_has_paper += 1;
-                    }
+    size_t radius = 3;
+    size_t threshold = 25;
+    mark_accessible_radius(grid, sat, radius, threshold);
+    for (ptrdiff_t row = 0; row < (ptrdiff_t)grid->height; row++) {
+        for (ptrdiff_t col = 0; col < (ptrdiff_t)grid->width; col++) {
+            size_t adj_has_paper = 0;
+            for (ptrdiff_t i = row - (ptrdiff_t)radius; i <= row + (ptrdiff_t)radius; i++) {
+                for (ptrdiff_t j = col - (ptrdiff_t)radius; j <= col + (ptrdiff_t)radius; j++) {
+                    if (i < 0 || j < 0 || i >= (ptrdiff_t)grid->height || j >= (ptrdiff_t)grid->width)
+                        continue;
+                    if (i == row && j == col)
+                        continue;
+                    adj_has_paper += bitgrid_get(grid, grid->paper, i, j);
                 }
             }
+            bool expected = bitgrid_get(grid, grid->paper, row, col) && adj_has_paper < threshold;
+            assert(bitgrid_get(grid, grid->accessible, row, col) == expected);
+        }
+    }
 
-            if (adj_has_paper < 4) {
-                grid_node_set_accessible(node);
-            }
+    sat_destroy(sat);
+    bitgrid_destroy(grid);
+    bitgrid_destroy(copy);
+    printf("test_radius passed.\n");
+}
+
+/* Lock-free parallel peeling.
+ * Same idea as execute_part2_worklist, but every thread pops from one
+ * shared frontier and neighbor counts are atomic. A roll is pushed by
+ * whichever thread's decrement takes its count from 4 to 3; fetch_sub
+ * makes that exactly one thread, so each roll is still pushed at most
+ * once and the frontier can be a flat array sized to the number of rolls.
+ *
+ * Pushing reserves a slot with fetch_add on `tail` and then publishes
+ * idx + 1 into it. Popping claims a slot with a CAS on `head` and waits
+ * for it to be published. `pending` counts rolls pushed but not finished,
+ * so a thread that finds the frontier empty only stops once nobody can
+ * push anything else.
+ *
+ * The set of removed rolls doesn't depend on the order they come off the
+ * frontier, so the total matches the sequential engines.
+ * */
+typedef struct {
+    bitgrid_t* grid;
+    size_t num_threads;
+    size_t cw;
+    ptrdiff_t offsets[8];
+    _Atomic uint8_t* counts;
+    _Atomic size_t* frontier;
+    atomic_size_t head;
+    atomic_size_t tail;
+    atomic_size_t pending;
+    atomic_size_t seeded; // size of the initial frontier, for telemetry
+    pthread_barrier_t barrier;
+} frontier_ctx_t;
+
+typedef struct {
+    frontier_ctx_t* ctx;
+    size_t id;
+} frontier_worker_t;
+
+void frontier_push(frontier_ctx_t* ctx, size_t idx) {
+    atomic_fetch_add_explicit(&ctx->pending, 1, memory_order_relaxed);
+    size_t slot = atomic_fetch_add_explicit(&ctx->tail, 1, memory_order_relaxed);
+    atomic_store_explicit(&ctx->frontier[slot], idx + 1, memory_order_release);
+}
+
+// Returns false once the frontier is empty for good.
+bool frontier_pop(frontier_ctx_t* ctx, size_t* idx) {
+    size_t h = atomic_load_explicit(&ctx->head, memory_order_relaxed);
+    while (true) {
+        size_t t = atomic_load_explicit(&ctx->tail, memory_order_acquire);
+        if (h >= t) {
+            if (atomic_load_explicit(&ctx->pending, memory_order_acquire) == 0)
+                return false;
+            sched_yield();
+            h = atomic_load_explicit(&ctx->head, memory_order_relaxed);
+            continue;
         }
+        if (atomic_compare_exchange_weak_explicit(&ctx->head, &h, h + 1,
+                    memory_order_relaxed, memory_order_relaxed))
+            break;
+    }
+
+    size_t value;
+    while ((value = atomic_load_explicit(&ctx->frontier[h], memory_order_acquire)) == 0) {
+        // claimed before the pusher published it; only a few instructions away.
+    }
+    *idx = value - 1;
+    return true;
+}
+
+void* frontier_worker(void* arg) {
+    frontier_worker_t* worker = (frontier_worker_t*)arg;
+    frontier_ctx_t* ctx = worker->ctx;
+    bitgrid_t* grid = ctx->grid;
 
-        for (size_t i = 0; i < grid->n; i++) {
-            if (grid_node_has_flags(grid->nodes + i, NODE_PAPER | NODE_ACCESSIBLE)) {
-                grid_node_unset_flags(grid->nodes + i, NODE_PAPER);
-                num_changed++;
+    // seed: this thread's band of rows, like run_bands.
+    size_t row_begin = grid->height * worker->id / ctx->num_threads;
+    size_t row_end = grid->height * (worker->id + 1) / ctx->num_threads;
+    size_t seeded = 0;
+    for (size_t row = row_begin; row < row_end; row++) {
+        for (size_t col = 0; col < grid->width; col++) {
+            if (!bitgrid_get(grid, grid->paper, row, col))
+                continue;
+            size_t idx = (row + 1) * ctx->cw + col + 1;
+            uint8_t count = bitgrid_count_adjacent(grid, row, col);
+            atomic_store_explicit(&ctx->counts[idx], count, memory_order_relaxed);
+            if (count < 4) {
+                frontier_push(ctx, idx);
+                seeded++;
             }
         }
-        total_changed += num_changed;
-        printf("%i (%i).\n", num_changed, total_changed);
+    }
+    atomic_fetch_add_explicit(&ctx->seeded, seeded, memory_order_relaxed);
+    // every count has to be in place before anyone starts decrementing.
+    pthread_barrier_wait(&ctx->barrier);
+
+    size_t idx;
+    while (frontier_pop(ctx, &idx)) {
+        size_t row = idx / ctx->cw - 1;
+        size_t col = idx % ctx->cw - 1;
+        uint64_t* word = &bitgrid_row(grid, grid->paper, row)[col / WORD_BITS];
+        __atomic_fetch_and(word, ~((uint64_t)1 << (col % WORD_BITS)), __ATOMIC_RELAXED);
+
+        for (int k = 0; k < 8; k++) {
+            size_t adj = idx + ctx->offsets[k];
+            // NO_ROLL cells are never written, so a plain load is enough.
+            if (atomic_load_explicit(&ctx->counts[adj], memory_order_relaxed) == NO_ROLL)
+                continue;
+            if (atomic_fetch_sub_explicit(&ctx->counts[adj], 1, memory_order_relaxed) == 4)
+                frontier_push(ctx, adj);
+        }
+        atomic_fetch_sub_explicit(&ctx->pending, 1, memory_order_release);
+    }
+    return NULL;
+}
+
+size_t execute_part2_frontier(bitgrid_t* grid, size_t num_threads) {
+    if (num_threads == 0)
+        num_threads = 1;
+
+    frontier_ctx_t ctx;
+    ctx.grid = grid;
+    ctx.num_threads = num_threads;
+    ctx.cw = grid->width + 2;
+    ptrdiff_t cw = (ptrdiff_t)ctx.cw;
+    const ptrdiff_t offsets[8] = { -cw - 1, -cw, -cw + 1, -1, 1, cw - 1, cw, cw + 1 };
+    memcpy(ctx.offsets, offsets, sizeof(offsets));
+
+    size_t cells = ctx.cw * (grid->height + 2);
+    ctx.counts = (_Atomic uint8_t*)malloc(cells);
+    memset((void*)ctx.counts, NO_ROLL, cells);
+    ctx.frontier = (_Atomic size_t*)calloc(bitgrid_count(grid, grid->paper) + 1, sizeof(size_t));
+    atomic_init(&ctx.head, 0);
+    atomic_init(&ctx.tail, 0);
+    atomic_init(&ctx.pending, 0);
+    atomic_init(&ctx.seeded, 0);
+    pthread_barrier_init(&ctx.barrier, NULL, num_threads);
+
+    double start = telemetry ? seconds_now() : 0;
+    pthread_t* threads = (pthread_t*)malloc(sizeof(pthread_t) * num_threads);
+    frontier_worker_t* workers = (frontier_worker_t*)malloc(sizeof(frontier_worker_t) * num_threads);
+    for (size_t i = 0; i < num_threads; i++) {
+        workers[i] = (frontier_worker_t){ .ctx = &ctx, .id = i };
+        pthread_create(&threads[i], NULL, frontier_worker, &workers[i]);
+    }
+    for (size_t i = 0; i < num_threads; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    size_t removed = atomic_load(&ctx.tail);
+    if (telemetry) {
+        // no rounds here, so one row for the whole run.
+        telemetry_round(telemetry, 1, seconds_now() - start,
+                        bitgrid_cells(grid) + 8 * removed, removed, atomic_load(&ctx.seeded));
+    }
+    pthread_barrier_destroy(&ctx.barrier);
+    free((void*)ctx.counts);
+    free((void*)ctx.frontier);
+    free(threads);
+    free(workers);
+    return removed;
+}
+
+void test_frontier() {
+    srand(35);
+    for (size_t threads = 1; threads <= 4; threads++) {
+        bitgrid_t* grid = random_bitgrid(97, 53, 70);
+        bitgrid_t* copy = bitgrid_copy(grid);
+
+        assert(execute_part2_frontier(grid, threads) == execute_part2_worklist(copy));
+        assert(bitgrid_equal(grid, grid->paper, copy, copy->paper));
+        bitgrid_destroy(grid);
+        bitgrid_destroy(copy);
+    }
+
+    printf("test_frontier passed.\n");
+}
+
+/* What is wrong with an input grid. Every loader follows the same rule:
+ * the first row sets the width, every row has to match it, and a blank
+ * line ends the grid, only more blank lines may follow it.
+ * */
+typedef enum {
+    GRID_OK,
+    GRID_RAGGED,   // a row that isn't width cells wide
+    GRID_TRAILING, // a row after the blank line that ended the grid
+} grid_error_t;
+
+void grid_fail(grid_error_t error, size_t row, size_t width) {
+    if (error == GRID_RAGGED)
+        printf("ROW %zu IS NOT %zu CELLS WIDE.\n", row, width);
+    else
+        printf("UNEXPECTED DATA AFTER ROW %zu.\n", row);
+    exit(-1);
+}
+
+/* The grid rule for loaders that see one line at a time, lengths without
+ * the line ending. height counts the rows so far.
+ * */
+typedef struct {
+    size_t width;
+    size_t height;
+    bool ended;
+} grid_shape_t;
+
+grid_error_t grid_shape_add(grid_shape_t* shape, size_t len) {
+    if (len == 0) {
+        shape->ended = true;
+        return GRID_OK;
+    }
+    if (shape->ended)
+        return GRID_TRAILING;
+    if (shape->height == 0)
+        shape->width = len;
+    if (len != shape->width)
+        return GRID_RAGGED;
+    shape->height++;
+    return GRID_OK;
+}
+
+/* The input file mapped read-only. Row i starts at data + i * stride, and
+ * stride is the length of the first line plus its line ending, so the
+ * rows are addressed in place and never copied.
+ * */
+typedef struct {
+    const char* data;
+    size_t size;
+    size_t width;
+    size_t stride;
+    size_t height;
+} mapped_grid_t;
+
+/* Sets width, stride and height from the mapped bytes and checks them
+ * with the grid_error_t rule. On an error height is the row at fault.
+ * */
+grid_error_t mapped_grid_scan(mapped_grid_t* map) {
+    const char* newline = memchr(map->data, '\n', map->size);
+    size_t line_len = newline != NULL ? (size_t)(newline - map->data) : map->size;
+    map->stride = line_len + 1;
+    map->width = line_len;
+    if (map->width > 0 && map->data[map->width - 1] == '\r')
+        map->width--;
+
+    // the grid_error_t rule on raw bytes: every row must also end exactly
+    // where the first one did.
+    map->height = 0;
+    size_t offset = 0;
+    for (; offset < map->size && map->width > 0; offset += map->stride) {
+        const char* row = map->data + offset;
+        if (row[0] == '\n' || row[0] == '\r')
+            break;
+        size_t rest = map->size - offset;
+        bool bad = rest < map->width || memchr(row, '\n', map->width) != NULL;
+        if (!bad && rest > map->width) {
+            // the line ending, possibly cut short by the end of the file
+            const char* ending = map->stride == map->width + 2 ? "\r\n" : "\n";
+            size_t len = rest - map->width < map->stride - map->width ? rest - map->width : map->stride - map->width;
+            bad = memcmp(row + map->width, ending, len) != 0;
+        }
+        if (bad)
+            return GRID_RAGGED;
+        map->height++;
+    }
+    for (; offset < map->size; offset++) {
+        if (map->data[offset] != '\n' && map->data[offset] != '\r')
+            return GRID_TRAILING;
+    }
+    return GRID_OK;
+}
+
+mapped_grid_t* mapped_grid_open(const char* filename) {
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        printf("FAILED TO OPEN INPUT FILE.\n");
+        exit(-1);
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        printf("EMPTY INPUT FILE.\n");
+        exit(-1);
+    }
+
+    mapped_grid_t* map = (mapped_grid_t*)malloc(sizeof(mapped_grid_t));
+    map->size = (size_t)st.st_size;
+    map->data = (const char*)mmap(NULL, map->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map->data == MAP_FAILED) {
+        printf("FAILED TO MAP INPUT FILE.\n");
+        exit(-1);
+    }
+    madvise((void*)map->data, map->size, MADV_SEQUENTIAL);
+
+    grid_error_t error = mapped_grid_scan(map);
+    if (error != GRID_OK)
+        grid_fail(error, map->height, map->width);
+    if (map->height == 0) {
+        printf("EMPTY INPUT FILE.\n");
+        exit(-1);
+    }
+    return map;
+}
+
+void mapped_grid_close(mapped_grid_t* map) {
+    munmap((void*)map->data, map->size);
+    free(map);
+}
+
+const char* mapped_grid_row(mapped_grid_t* map, size_t row) {
+    return map->data + row * map->stride;
+}
+
+/* Part 1 straight off the mapped bytes.
+ * For each row, first sum the '@'s of the rows above, at and below into
+ * one column total per cell, then a cell's neighbor count is three
+ * adjacent column totals minus itself. Both loops are plain byte math
+ * the compiler vectorizes. Only two rows of scratch are allocated, an
+ * all-'.' row standing in above the first and below the last row, and
+ * the column totals with a zero on either side.
+ * */
+size_t count_accessible_mapped(mapped_grid_t* map) {
+    size_t width = map->width;
+    char* empty = (char*)malloc(width);
+    memset(empty, '.', width);
+    uint8_t* column = (uint8_t*)calloc(width + 2, 1);
+
+    size_t num_accessible = 0;
+    for (size_t row = 0; row < map->height; row++) {
+        const char* up = row > 0 ? mapped_grid_row(map, row - 1) : empty;
+        const char* mid = mapped_grid_row(map, row);
+        const char* down = row + 1 < map->height ? mapped_grid_row(map, row + 1) : empty;
+        for (size_t j = 0; j < width; j++) {
+            column[j + 1] = (up[j] == '@') + (mid[j] == '@') + (down[j] == '@');
+        }
+        for (size_t j = 0; j < width; j++) {
+            int adj_has_paper = column[j] + column[j + 1] + column[j + 2] - 1;
+            num_accessible += (mid[j] == '@') & (adj_has_paper < 4);
+        }
+    }
+
+    free(empty);
+    free(column);
+    return num_accessible;
+}
+
+size_t execute_part1_mapped(mapped_grid_t* map) {
+    size_t num_accessible = count_accessible_mapped(map);
+    printf("Part 1 answer: %zu\n", num_accessible);
+    return num_accessible;
+}
+
+/* '@' -> 1 bit for `width` bytes of src, written to dst as packed words.
+ * One vector compare + movemask per 32 (AVX2) or 16 (SSE2) bytes.
+ * */
+void pack_row(const char* src, size_t width, uint64_t* dst) {
+    size_t i = 0;
+#if defined(__AVX2__)
+    const __m256i paper = _mm256_set1_epi8('@');
+    for (; i + 64 <= width; i += 64) {
+        __m256i lo = _mm256_loadu_si256((const __m256i*)(src + i));
+        __m256i hi = _mm256_loadu_si256((const __m256i*)(src + i + 32));
+        uint32_t lo_bits = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(lo, paper));
+        uint32_t hi_bits = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(hi, paper));
+        dst[i / WORD_BITS] = (uint64_t)lo_bits | ((uint64_t)hi_bits << 32);
+    }
+#elif defined(__SSE2__)
+    const __m128i paper = _mm_set1_epi8('@');
+    for (; i + 64 <= width; i += 64) {
+        uint64_t word = 0;
+        for (int k = 0; k < 4; k++) {
+            __m128i v = _mm_loadu_si128((const __m128i*)(src + i + k * 16));
+            uint64_t bits = (uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, paper));
+            word |= bits << (k * 16);
+        }
+        dst[i / WORD_BITS] = word;
+    }
+#endif
+    for (; i < width; i += WORD_BITS) {
+        uint64_t word = 0;
+        size_t n = width - i < WORD_BITS ? width - i : WORD_BITS;
+        for (size_t k = 0; k < n; k++) {
+            word |= (uint64_t)(src[i + k] == '@') << k;
+        }
+        dst[i / WORD_BITS] = word;
     }
 }
 
-int main() {
-    test_grid();
-    FILE* file = fopen("input.txt", "r");
+// One compare pass over the mapping; the bitgrid is sized up front.
+bitgrid_t* bitgrid_from_mapped(mapped_grid_t* map) {
+    bitgrid_t* grid = bitgrid_create(map->width, map->height);
+    for (size_t row = 0; row < map->height; row++) {
+        pack_row(mapped_grid_row(map, row), map->width, bitgrid_add_row(grid));
+    }
+    return grid;
+}
+
+/* Reads a file (or stdin for "-") in LINE_READER_BLOCK sized chunks and
+ * hands out one line at a time, without its line ending. The buffer only
+ * grows if a single line doesn't fit, so memory is O(longest line).
+ * A returned line is valid until the next call.
+ * */
+#define LINE_READER_BLOCK (1 << 20)
+
+typedef struct {
+    FILE* file;
+    char* buf;
+    size_t cap;
+    size_t start; // first byte not handed out yet
+    size_t end;   // one past the last byte read
+    bool eof;
+} line_reader_t;
+
+line_reader_t* line_reader_open(const char* filename) {
+    FILE* file = strcmp(filename, "-") == 0 ? stdin : fopen(filename, "r");
     if (file == NULL) {
         printf("FAILED TO OPEN INPUT FILE.\n");
         exit(-1);
     }
+    line_reader_t* reader = (line_reader_t*)malloc(sizeof(line_reader_t));
+    reader->file = file;
+    reader->cap = LINE_READER_BLOCK;
+    reader->buf = (char*)malloc(reader->cap);
+    reader->start = 0;
+    reader->end = 0;
+    reader->eof = false;
+    return reader;
+}
+
+void line_reader_close(line_reader_t* reader) {
+    if (reader->file != stdin)
+        fclose(reader->file);
+    free(reader->buf);
+    free(reader);
+}
+
+const char* line_reader_next(line_reader_t* reader, size_t* len) {
+    size_t scanned = reader->start;
+    while (true) {
+        char* newline = memchr(reader->buf + scanned, '\n', reader->end - scanned);
+        if (newline != NULL) {
+            const char* line = reader->buf + reader->start;
+            *len = (size_t)(newline - line);
+            reader->start += *len + 1;
+            if (*len > 0 && line[*len - 1] == '\r')
+                (*len)--;
+            return line;
+        }
+
+        if (reader->eof) {
+            if (reader->start == reader->end)
+                return NULL;
+            // last line without a newline.
+            const char* line = reader->buf + reader->start;
+            *len = reader->end - reader->start;
+            reader->start = reader->end;
+            if (*len > 0 && line[*len - 1] == '\r')
+                (*len)--;
+            return line;
+        }
+
+        // keep the partial line, then top the buffer up.
+        size_t partial = reader->end - reader->start;
+        memmove(reader->buf, reader->buf + reader->start, partial);
+        reader->start = 0;
+        reader->end = partial;
+        scanned = partial;
+        if (reader->end == reader->cap) {
+            reader->cap *= 2;
+            reader->buf = (char*)realloc(reader->buf, reader->cap);
+        }
+        size_t n = fread(reader->buf + reader->end, 1, reader->cap - reader->end, reader->file);
+        reader->end += n;
+        if (n == 0)
+            reader->eof = true;
+    }
+}
+
+/* Part 1 without holding the grid.
+ * A cell only needs the rows above and below it, so keep a window of
+ * three packed rows (with guard words, like a bitgrid) and rotate it as
+ * rows come in. Memory is the reader's buffer plus four rows: O(width)
+ * no matter how many rows the input has.
+ * */
+size_t count_accessible_stream(const char* filename) {
+    line_reader_t* reader = line_reader_open(filename);
+    size_t width = 0;
+    size_t words = 0;
+    size_t stride = 0;
+    uint64_t* window = NULL;
+    uint64_t* up = NULL;
+    uint64_t* mid = NULL;
+    uint64_t* down = NULL;
+    uint64_t* mask = NULL;
+    size_t rows = 0;
+    size_t num_accessible = 0;
+
+    grid_shape_t shape = { 0 };
+    const char* line;
+    size_t len;
+    while ((line = line_reader_next(reader, &len)) != NULL) {
+        grid_error_t error = grid_shape_add(&shape, len);
+        if (error != GRID_OK)
+            grid_fail(error, shape.height, shape.width);
+        if (len == 0)
+            continue;
+        if (window == NULL) {
+            width = len;
+            words = row_words(width);
+            stride = words + 2;
+            window = (uint64_t*)calloc(4 * stride, sizeof(uint64_t));
+            up = window + 1;
+            mid = window + stride + 1;
+            down = window + 2 * stride + 1;
+            mask = window + 3 * stride + 1;
+        }
+
+        pack_row(line, width, down);
+        if (rows > 0) {
+            row_lt4_mask(up, mid, down, mask, words);
+            for (size_t w = 0; w < words; w++) {
+                num_accessible += __builtin_popcountll(mask[w]);
+            }
+        }
+        // up <- mid <- down, and the old up is the next row's buffer.
+        uint64_t* tmp = up;
+        up = mid;
+        mid = down;
+        down = tmp;
+        rows++;
+    }
+
+    if (rows > 0) {
+        memset(down, 0, words * sizeof(uint64_t));
+        row_lt4_mask(up, mid, down, mask, words);
+        for (size_t w = 0; w < words; w++) {
+            num_accessible += __builtin_popcountll(mask[w]);
+        }
+    }
+
+    free(window);
+    line_reader_close(reader);
+    return num_accessible;
+}
 
-    char buf[256];
-    grid_t* grid = NULL;
-    while(fgets(buf, sizeof(buf), file) != NULL) {
+size_t execute_part1_stream(const char* filename) {
+    size_t num_accessible = count_accessible_stream(filename);
+    printf("Part 1 answer: %zu\n", num_accessible);
+    return num_accessible;
+}
+
+/* Loads the grid through line_reader_t, so rows can be any width. The
+ * rows are checked with grid_shape_t; a ragged row is an error instead of
+ * silently becoming extra rows.
+ * */
+bitgrid_t* bitgrid_load(const char* filename) {
+    line_reader_t* reader = line_reader_open(filename);
+    bitgrid_t* grid = NULL;
+    grid_shape_t shape = { 0 };
+    const char* line;
+    size_t len;
+    while ((line = line_reader_next(reader, &len)) != NULL) {
+        grid_error_t error = grid_shape_add(&shape, len);
+        if (error != GRID_OK)
+            grid_fail(error, shape.height, shape.width);
+        if (len == 0)
+            continue;
         if (grid == NULL) {
-            size_t stride = strlen(buf);
-            grid = grid_create(stride, 1024);
+            grid = bitgrid_create(len, DEFAULT_ROW_CAP);
         }
+        pack_row(line, len, bitgrid_add_row(grid));
+    }
+    line_reader_close(reader);
+    if (grid == NULL) {
+        printf("EMPTY INPUT FILE.\n");
+        exit(-1);
+    }
+    return grid;
+}
+
+// The grid_error_t that bitgrid_load and count_accessible_stream stop
+// on, found without exiting.
+grid_error_t check_lines(const char* path) {
+    line_reader_t* reader = line_reader_open(path);
+    grid_shape_t shape = { 0 };
+    grid_error_t error = GRID_OK;
+    size_t len;
+    while (error == GRID_OK && line_reader_next(reader, &len) != NULL)
+        error = grid_shape_add(&shape, len);
+    line_reader_close(reader);
+    return error;
+}
+
+void test_mapped() {
+    // a path of our own, so runs started together don't share one
+    char path[] = "/tmp/paper_test_mapped_XXXXXX";
+    int fd = mkstemp(path);
+    assert(fd >= 0);
+    FILE* file = fdopen(fd, "w");
+    assert(file != NULL);
+    srand(32);
+    size_t width = 131;
+    bitgrid_t* source = random_bitgrid(width, 20, 70);
+    bitgrid_write(source, file, "\n");
+    fclose(file);
+
+    mapped_grid_t* map = mapped_grid_open(path);
+    assert(map->width == width && map->stride == width + 1 && map->height == 20);
+    bitgrid_t* grid = bitgrid_from_mapped(map);
+    bitgrid_t* loaded = bitgrid_load(path);
+    assert(bitgrid_equal(grid, grid->paper, source, source->paper));
+    assert(bitgrid_equal(grid, grid->paper, loaded, loaded->paper));
+    bitgrid_destroy(source);
+
+    mark_accessible(loaded);
+    assert(count_accessible_mapped(map) == bitgrid_count(loaded, loaded->accessible));
+
+    bitgrid_destroy(grid);
+    bitgrid_destroy(loaded);
+    mapped_grid_close(map);
+
+    // bad grids: the mapped bytes and the lines must fail the same way
+    const char* ragged[] = {
+        "@@@\n@\n@\n",         // newline inside a row
+        "@@@\r\n@@@@\n",       // CRLF file, a row without its \r
+        "@@@\n@@",             // short last row, no newline
+        "@@@\n@@\n",           // short last row
+        "@@@\n\n@@@\n",        // a row after the blank line
+        "\n@@@\n",             // a row after a leading blank line
+    };
+    for (size_t i = 0; i < sizeof(ragged) / sizeof(ragged[0]); i++) {
+        file = fopen(path, "w");
+        fputs(ragged[i], file);
+        fclose(file);
+        mapped_grid_t bytes = { .data = ragged[i], .size = strlen(ragged[i]) };
+        grid_error_t error = mapped_grid_scan(&bytes);
+        assert(error != GRID_OK && error == check_lines(path));
+    }
+
+    // and the same grid however its lines end
+    const char* even[] = { "@@@\n.@.\n", "@@@\n.@.", "@@@\r\n.@.\r\n", "@@@\r\n.@.", "@@@\n.@.\n\n\n" };
+    for (size_t i = 0; i < sizeof(even) / sizeof(even[0]); i++) {
+        file = fopen(path, "w");
+        fputs(even[i], file);
+        fclose(file);
+        map = mapped_grid_open(path);
+        grid = bitgrid_from_mapped(map);
+        loaded = bitgrid_load(path);
+        assert(map->height == 2 && bitgrid_equal(grid, grid->paper, loaded, loaded->paper));
+        bitgrid_destroy(grid);
+        bitgrid_destroy(loaded);
+        mapped_grid_close(map);
+    }
+    remove(path);
+    printf("test_mapped passed.\n");
+}
+
+void test_stream() {
+    // a path of our own, so runs started together don't share one
+    char path[] = "/tmp/paper_test_stream_XXXXXX";
+    int fd = mkstemp(path);
+    assert(fd >= 0);
+    FILE* file = fdopen(fd, "w");
+    assert(file != NULL);
+    srand(33);
+    size_t width = 77;
+    bitgrid_t* source = random_bitgrid(width, 25, 70);
+    bitgrid_write(source, file, "\r\n");
+    fclose(file);
 
-        for (size_t i = 0; i < strlen(buf); i++) {
-            int val = (*(buf + i) == '@') ? NODE_PAPER : NODE_EMPTY;
-            grid_add_node(grid, val);
+    line_reader_t* reader = line_reader_open(path);
+    size_t len = 0;
+    size_t lines = 0;
+    while (line_reader_next(reader, &len) != NULL) {
+        assert(len == width);
+        lines++;
+    }
+    assert(lines == 25);
+    line_reader_close(reader);
+
+    mapped_grid_t* map = mapped_grid_open(path);
+    size_t expected = count_accessible_mapped(map);
+    mapped_grid_close(map);
+    assert(count_accessible_stream(path) == expected);
+
+    bitgrid_t* grid = bitgrid_load(path);
+    assert(bitgrid_equal(grid, grid->paper, source, source->paper));
+    bitgrid_destroy(source);
+    mark_accessible(grid);
+    assert(bitgrid_count(grid, grid->accessible) == expected);
+    bitgrid_destroy(grid);
+
+    // the grid rule all three loaders share, on line lengths
+    grid_shape_t shape = { 0 };
+    assert(grid_shape_add(&shape, 3) == GRID_OK && grid_shape_add(&shape, 3) == GRID_OK);
+    assert(grid_shape_add(&shape, 2) == GRID_RAGGED && shape.height == 2);
+    shape = (grid_shape_t){ 0 };
+    assert(grid_shape_add(&shape, 3) == GRID_OK && grid_shape_add(&shape, 0) == GRID_OK);
+    assert(grid_shape_add(&shape, 0) == GRID_OK && shape.height == 1);
+    assert(grid_shape_add(&shape, 3) == GRID_TRAILING);
+    shape = (grid_shape_t){ 0 };
+    assert(grid_shape_add(&shape, 0) == GRID_OK && grid_shape_add(&shape, 3) == GRID_TRAILING);
+
+    remove(path);
+    printf("test_stream passed.\n");
+}
+
+/* Usage: paper [--engine=rounds|worklist|bands|frontier] [--threads=N] [--mmap] [--stream]
+ *              [--radius=R] [--threshold=T] [--bench-tiles]
+ *              [--telemetry=csv|json] [input file]
+ * --stream - part 1 only, in O(width) memory, see execute_part1_stream.
+ *            An input file of "-" reads stdin.
+ * --mmap   - map the input, run part 1 on the raw bytes and pack the grid
+ *            for part 2 in one pass, see execute_part1_mapped.
+ * rounds   - rescan the whole grid until nothing changes (default).
+ * worklist - incremental peeling, see execute_part2_worklist.
+ * bands    - rounds split across threads, see run_bands. --threads
+ *            defaults to the number of online cores.
+ * frontier - lock-free multi-threaded worklist, see execute_part2_frontier.
+ *
+ * --telemetry=csv|json writes per-round part 2 stats to stderr, see
+ * telemetry_t.
+ * --bench-tiles compares the row and tile layouts, see bench_tiles.
+ *
+ * --radius=R --threshold=T switch to the generalized rule (fewer than T
+ * rolls within R cells), evaluated with summed-area tables; see
+ * mark_accessible_radius. The engine is ignored in that mode.
+ * */
+int main(int argc, char** argv) {
+    test_bitgrid();
+    test_kernel();
+    test_worklist();
+    test_bands();
+    test_frontier();
+    test_radius();
+    test_tiles();
+    test_mapped();
+    test_stream();
+
+    const char* filename = "input.txt";
+    const char* engine = "rounds";
+    long num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    bool use_mmap = false;
+    bool stream = false;
+    size_t radius = 1;
+    size_t threshold = 4;
+    bool tile_bench = false;
+    telemetry_t tm = { .out = stderr };
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--engine=", 9) == 0) {
+            engine = argv[i] + 9;
+        } else if (strncmp(argv[i], "--threads=", 10) == 0) {
+            num_threads = strtol(argv[i] + 10, NULL, 10);
+        } else if (strcmp(argv[i], "--mmap") == 0) {
+            use_mmap = true;
+        } else if (strcmp(argv[i], "--stream") == 0) {
+            stream = true;
+        } else if (strncmp(argv[i], "--radius=", 9) == 0) {
+            radius = strtoull(argv[i] + 9, NULL, 10);
+        } else if (strncmp(argv[i], "--threshold=", 12) == 0) {
+            threshold = strtoull(argv[i] + 12, NULL, 10);
+        } else if (strcmp(argv[i], "--bench-tiles") == 0) {
+            tile_bench = true;
+        } else if (strcmp(argv[i], "--telemetry=csv") == 0) {
+            tm.format = TELEMETRY_CSV;
+            telemetry = &tm;
+        } else if (strcmp(argv[i], "--telemetry=json") == 0) {
+            tm.format = TELEMETRY_JSON;
+            telemetry = &tm;
+        } else {
+            filename = argv[i];
         }
     }
 
-    execute_part1(grid);
-    execute_part2(grid);
-    grid_destroy(grid);
+    if (num_threads < 1)
+        num_threads = 1;
+
+    if (stream) {
+        execute_part1_stream(filename);
+        return 0;
+    }
+
+    if (tile_bench) {
+        bitgrid_t* grid = bitgrid_load(filename);
+        bench_tiles(grid);
+        bitgrid_destroy(grid);
+        return 0;
+    }
+
+    if (radius != 1 || threshold != 4) {
+        bitgrid_t* grid = bitgrid_load(filename);
+        execute_part1_radius(grid, radius, threshold);
+        if (telemetry)
+            telemetry_begin(telemetry, "radius");
+        printf("Part 2 answer: %zu\n", execute_part2_radius(grid, radius, threshold));
+        if (telemetry)
+            telemetry_end(telemetry);
+        bitgrid_destroy(grid);
+        return 0;
+    }
+
+    bitgrid_t* grid = NULL;
+    if (use_mmap) {
+        mapped_grid_t* map = mapped_grid_open(filename);
+        execute_part1_mapped(map);
+        grid = bitgrid_from_mapped(map);
+        mapped_grid_close(map);
+    } else {
+        grid = bitgrid_load(filename);
+    }
+
+    bool threaded = strcmp(engine, "bands") == 0 || strcmp(engine, "frontier") == 0;
+    if (!threaded && strcmp(engine, "rounds") != 0 && strcmp(engine, "worklist") != 0) {
+        printf("UNKNOWN ENGINE '%s'.\n", engine);
+        exit(-1);
+    }
+    if (!use_mmap) {
+        if (threaded)
+            execute_part1_bands(grid, num_threads);
+        else
+            execute_part1(grid);
+    }
+
+    if (telemetry)
+        telemetry_begin(telemetry, engine);
+    size_t part2 = 0;
+    if (strcmp(engine, "rounds") == 0) {
+        part2 = execute_part2(grid);
+    } else if (strcmp(engine, "worklist") == 0) {
+        part2 = execute_part2_worklist(grid);
+    } else if (strcmp(engine, "bands") == 0) {
+        part2 = execute_part2_bands(grid, num_threads);
+    } else {
+        part2 = execute_part2_frontier(grid, num_threads);
+    }
+    if (telemetry)
+        telemetry_end(telemetry);
+    printf("Part 2 answer: %zu\n", part2);
+    bitgrid_destroy(grid);
 }
@@ -1,10 +1,21 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdint.h>
+#include <stddef.h>
 #include <stdbool.h>
 #include <assert.h>
 #include <string.h>
-#include <ctype.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <signal.h>
+#include <errno.h>
 
 typedef struct {
     size_t start;
@@ -146,267 +157,513 @@ range_t* range_array_add_range(range_array_t* arr, size_t start, size_t end) {
     return range;
 }
 
-typedef struct range_node range_node_t;
-typedef struct range_node {
-    range_t range;
-    range_node_t* left;
-    range_node_t* right;
-} range_node_t;
-
-typedef struct {
-    range_node_t* ranges;
-    size_t len;
-    size_t cap;
-    range_node_t* root;
-} bst_t;
-
-void bst_debug_print(range_node_t* node);
+void range_array_free(range_array_t* arr) {
+    free(arr->ptr);
+    arr->ptr = NULL;
+    arr->cap = 0;
+    arr->len = 0;
+    free(arr);
+}
 
-bst_t* bst_create(size_t cap) {
-    bst_t* bst = (bst_t*)malloc(sizeof(bst_t));
-    bst->len = 0;
-    bst->root = NULL;
-    bst->ranges = (range_node_t*)malloc(sizeof(range_node_t) * cap);
-    bst->cap = cap;
-    return bst;
+// next must not start before prev. Ranges that only touch (5-7, 8-9) are
+// merged too, they cover the same ids and the index gets shorter.
+bool range_mergeable(range_t* prev, range_t* next) {
+    return next->start <= prev->end || next->start - prev->end == 1;
 }
 
-void bst_free(bst_t* bst) {
-    free(bst->ranges);
-    bst->ranges = NULL;
-    bst->root = NULL;
-    bst->cap = 0;
-    bst->len = 0;
-    free(bst);
+int range_compare_start(const void* a, const void* b) {
+    const range_t* range1 = (const range_t*)a;
+    const range_t* range2 = (const range_t*)b;
+    if (range1->start != range2->start)
+        return range1->start < range2->start ? -1 : 1;
+    return 0;
 }
 
-range_node_t* bst_node_push(bst_t* bst, range_t range) {
-    if (bst->len >= bst->cap) {
-        size_t new_cap = bst->cap * 2;
-        bst->ranges = (range_node_t*)realloc(bst->ranges, new_cap * sizeof(range_node_t));
-        bst->cap = new_cap;
+#define RADIX_BITS 8
+#define RADIX_BUCKETS (1 << RADIX_BITS)
+#define RADIX_PASSES (64 / RADIX_BITS)
+#define RADIX_MIN_LEN 64
+
+// LSD radix sort of len elements of size bytes on the uint64_t key at
+// key_offset, one byte per pass. All eight histograms are built in a single
+// read and a pass is skipped when every key has the same byte there, which
+// drops the high bytes of puzzle-sized ids. The callers pass constant sizes
+// so the element copies inline.
+static inline void radix_sort(void* base, size_t len, size_t size, size_t key_offset) {
+    size_t (*counts)[RADIX_BUCKETS] = calloc(RADIX_PASSES, sizeof(*counts));
+    for (size_t i = 0; i < len; i++) {
+        uint64_t key;
+        memcpy(&key, (char*)base + i * size + key_offset, sizeof(key));
+        for (int pass = 0; pass < RADIX_PASSES; pass++)
+            counts[pass][(key >> (pass * RADIX_BITS)) & (RADIX_BUCKETS - 1)]++;
     }
 
-    range_node_t* node = &bst->ranges[bst->len++];
-    node->range = range;
-    node->left = NULL;
-    node->right = NULL;
-    return node;
+    char* scratch = (char*)malloc(size * len);
+    char* src = (char*)base;
+    char* dst = scratch;
+    for (int pass = 0; pass < RADIX_PASSES; pass++) {
+        int shift = pass * RADIX_BITS;
+        uint64_t first;
+        memcpy(&first, src + key_offset, sizeof(first));
+        if (counts[pass][(first >> shift) & (RADIX_BUCKETS - 1)] == len)
+            continue;
+
+        size_t offset = 0;
+        for (int b = 0; b < RADIX_BUCKETS; b++) {
+            size_t count = counts[pass][b];
+            counts[pass][b] = offset;
+            offset += count;
+        }
+        for (size_t i = 0; i < len; i++) {
+            uint64_t key;
+            memcpy(&key, src + i * size + key_offset, sizeof(key));
+            size_t b = (key >> shift) & (RADIX_BUCKETS - 1);
+            memcpy(dst + counts[pass][b]++ * size, src + i * size, size);
+        }
+        char* tmp = src;
+        src = dst;
+        dst = tmp;
+    }
+
+    if (src != (char*)base)
+        memcpy(base, src, size * len);
+    free(scratch);
+    free(counts);
 }
 
-range_node_t* bst_node_insert_recursive(range_node_t* node, range_node_t* new) {
-    bool overlap = range_overlap(&node->range, &new->range);
-    if (!overlap && new->range.start < node->range.start) {
-        if (node->left != NULL) {
-            return bst_node_insert_recursive(node->left, new);
-        } else { // node == left
-            node->left = new;
-            return node->left;
-        }
+// Sorts ranges on start, radix_sort above RADIX_MIN_LEN.
+void range_sort(range_t* ranges, size_t len) {
+    if (len < RADIX_MIN_LEN) {
+        qsort(ranges, len, sizeof(range_t), range_compare_start);
+        return;
     }
+    radix_sort(ranges, len, sizeof(range_t), offsetof(range_t, start));
+}
 
-    if (!overlap && new->range.start > node->range.start) {
-        if (node->right != NULL) {
-            return bst_node_insert_recursive(node->right, new);
+// Merges sorted ranges in place in one sweep, returns the new length.
+size_t range_merge_sorted(range_t* ranges, size_t len) {
+    size_t out = 0;
+    for (size_t i = 0; i < len; i++) {
+        range_t range = ranges[i];
+        if (out > 0 && range_mergeable(&ranges[out - 1], &range)) {
+            if (range.end > ranges[out - 1].end)
+                ranges[out - 1].end = range.end;
         } else {
-            node->right = new;
-            return node->right;
+            ranges[out++] = range;
         }
     }
+    return out;
+}
+
+// Sorted, merged ranges: no two overlap or touch, so an id can only be in
+// the last range starting at or before it.
+typedef struct {
+    range_t* ranges;
+    size_t len;
+} range_index_t;
+
+range_index_t* range_index_create(range_array_t* arr) {
+    range_index_t* index = (range_index_t*)malloc(sizeof(range_index_t));
+    index->ranges = (range_t*)malloc(sizeof(range_t) * (arr->len ? arr->len : 1));
+    memcpy(index->ranges, arr->ptr, sizeof(range_t) * arr->len);
+    range_sort(index->ranges, arr->len);
+    index->len = range_merge_sorted(index->ranges, arr->len);
+    return index;
+}
 
-    if (overlap) {
-        node->range = range_consolidate(&node->range, &new->range);
-        return node;
+void range_index_free(range_index_t* index) {
+    free(index->ranges);
+    index->ranges = NULL;
+    index->len = 0;
+    free(index);
+}
+
+bool range_index_contains(range_index_t* index, size_t id) {
+    // find the first range starting after id
+    size_t lo = 0;
+    size_t hi = index->len;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (index->ranges[mid].start <= id)
+            lo = mid + 1;
+        else
+            hi = mid;
     }
-    printf("Something weird:\nnode: %zu-%zu\nnew: %zu-%zu\n", 
-            node->range.start, node->range.end, new->range.start, new->range.end);
-    assert(false);
-    return NULL;
+    return lo > 0 && id <= index->ranges[lo - 1].end;
 }
 
-range_node_t* bst_node_delete(range_node_t* node) {
-    if (node == NULL)
-        return NULL;
+size_t range_index_count_ids(range_index_t* index) {
+    size_t accum = 0;
+    for (size_t i = 0; i < index->len; i++)
+        accum += range_count(&index->ranges[i]);
+    return accum;
+}
 
-    if (node->left == NULL) {
-        return node->right;
+// radix_sort for bare ids, an insertion sort below RADIX_MIN_LEN.
+void id_sort(size_t* ids, size_t len) {
+    if (len < RADIX_MIN_LEN) {
+        for (size_t i = 1; i < len; i++) {
+            size_t id = ids[i];
+            size_t j = i;
+            for (; j > 0 && ids[j - 1] > id; j--)
+                ids[j] = ids[j - 1];
+            ids[j] = id;
+        }
+        return;
     }
 
-    if (node->right == NULL) {
-        return node->left;
+    radix_sort(ids, len, sizeof(size_t), 0);
+}
+
+// ids must be sorted. Walks the ids and the ranges together once, so the
+// whole batch is two sequential reads instead of a search per id.
+size_t range_index_count_sorted(range_index_t* index, const size_t* ids, size_t len) {
+    size_t fresh = 0;
+    size_t r = 0;
+    for (size_t i = 0; i < len && r < index->len; i++) {
+        size_t id = ids[i];
+        while (r < index->len && index->ranges[r].end < id)
+            r++;
+        fresh += r < index->len && index->ranges[r].start <= id;
     }
+    return fresh;
+}
 
-    range_node_t* successor = node->right;
-    while (successor->left) {
-        successor = successor->left;
+// Sorts ids in place and counts the fresh ones.
+size_t range_index_count_batch(range_index_t* index, size_t* ids, size_t len) {
+    id_sort(ids, len);
+    return range_index_count_sorted(index, ids, len);
+}
+
+void test_range_index() {
+    range_array_t* arr = range_array_create(2);
+    range_array_add_range(arr, 16, 20);
+    range_array_add_range(arr, 3, 5);
+    range_array_add_range(arr, 12, 18);
+    range_array_add_range(arr, 10, 14);
+    range_array_add_range(arr, 21, 21);     // touches 10-20
+    range_array_add_range(arr, 30, 30);
+    range_array_add_range(arr, 3, 4);
+
+    range_index_t* index = range_index_create(arr);
+    assert(index->len == 3);
+    assert(index->ranges[0].start == 3  && index->ranges[0].end == 5);
+    assert(index->ranges[1].start == 10 && index->ranges[1].end == 21);
+    assert(index->ranges[2].start == 30 && index->ranges[2].end == 30);
+    assert(range_index_count_ids(index) == 3 + 12 + 1);
+
+    for (size_t id = 0; id < 40; id++) {
+        bool expected = false;
+        for (size_t i = 0; i < arr->len; i++)
+            expected |= range_contains(&arr->ptr[i], id);
+        assert(range_index_contains(index, id) == expected);
     }
-    node->range = successor->range;
-    bst_node_delete(successor);
-    return node;
+    range_index_free(index);
+
+    arr->len = 0;
+    index = range_index_create(arr);
+    assert(index->len == 0 && !range_index_contains(index, 0));
+    range_index_free(index);
+
+    range_array_add_range(arr, 0, SIZE_MAX - 1);
+    range_array_add_range(arr, SIZE_MAX, SIZE_MAX);
+    index = range_index_create(arr);
+    assert(index->len == 1);
+    assert(range_index_contains(index, 0) && range_index_contains(index, SIZE_MAX));
+    range_index_free(index);
+    range_array_free(arr);
+    printf("test_range_index passed.\n");
 }
 
-void bst_node_prune(range_node_t* node) {
+// xorshift64, keeps the generated ranges the same from run to run
+uint64_t next_random(uint64_t* state) {
+    uint64_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    *state = x;
+    return x;
+}
+
+// Dynamic set of fresh ranges: an AVL tree of disjoint, non-touching
+// ranges keyed by start. Inserting merges with every range the new one
+// overlaps or touches, removing splits the ranges it cuts, and the total
+// id count is kept up to date so part 2 is a field read.
+typedef struct range_set_node range_set_node_t;
+typedef struct range_set_node {
+    range_t range;
+    range_set_node_t* left;
+    range_set_node_t* right;
+    int height;
+} range_set_node_t;
+
+typedef struct {
+    range_set_node_t* root;
+    size_t len;     // ranges in the tree
+    size_t count;   // ids covered, wraps if every id is fresh
+} range_set_t;
+
+range_set_t* range_set_create() {
+    range_set_t* set = (range_set_t*)malloc(sizeof(range_set_t));
+    set->root = NULL;
+    set->len = 0;
+    set->count = 0;
+    return set;
+}
+
+void range_set_node_free(range_set_node_t* node) {
     if (node == NULL)
         return;
+    range_set_node_free(node->left);
+    range_set_node_free(node->right);
+    free(node);
+}
 
-    if (node->left != NULL && range_overlap(&node->range, &node->left->range)) {
-        node->range = range_consolidate(&node->range, &node->left->range);
-        range_node_t* old_left = node->left;
-        if (old_left->left && !old_left->right) {
-            node->left = old_left->left;
-        } else if(!old_left->left && old_left->right) {
-            node->left = old_left->right;
-        } else if (!old_left->left && !old_left->right) {
-            node->left = NULL;
-        } else {
-            assert(false);
-        }
-        // range_node_t* tmp_right = node->left->right;
-        // range_node_t* tmp_left = node->left->left;
-        // if (tmp_right != NULL) {
-        //     node->left = tmp_right;
-        //     tmp_right->left = tmp_left;
-        // } else {
-        //     node->left = tmp_left;
-        // }
-        // if (old_left->right != NULL) {
-        //     node->left = old_left->right;
-        //     node->left->left = old_left->left;
-        // } else {
-        //     node->left = old_left->left;
-        // }
-    }
-
-    if (node->right != NULL && range_overlap(&node->range, &node->right->range)) {
-        node->range = range_consolidate(&node->range, &node->right->range);
-        range_node_t* old_right = node->right;
-        if (old_right->left && !old_right->right) 
-            node->right = old_right->left;
-        else if (!old_right->left && old_right->right)
-            node->right = old_right->right;
-        else if (!old_right->left && !old_right->right) {
-            node->right = NULL;
-        } else {
-            assert(false);
-        }
-        // range_node_t* tmp_right = node->right->right;
-        // range_node_t* tmp_left  = node->right->left;
-        // if (tmp_left != NULL) {
-        //     node->right = tmp_left;
-        //     tmp_left->right = tmp_right;
-        // } else {
-        //     node->right = tmp_left;
-        // }
-        // if (old_right->left != NULL) {
-        //     node->right = old_right->left;
-        //     node->right->right = old_right->right;
-        // } else {
-        //     node->right = old_right->left;
-        // }
-    }
+void range_set_free(range_set_t* set) {
+    range_set_node_free(set->root);
+    set->root = NULL;
+    set->len = 0;
+    set->count = 0;
+    free(set);
+}
 
-    bst_node_prune(node->left);
-    bst_node_prune(node->right);
+int range_set_height(range_set_node_t* node) {
+    return node ? node->height : 0;
 }
 
-bool bst_check_tree(range_node_t* node) {
-    if (node == NULL)
-        return true;
+void range_set_update(range_set_node_t* node) {
+    int left = range_set_height(node->left);
+    int right = range_set_height(node->right);
+    node->height = 1 + (left > right ? left : right);
+}
+
+range_set_node_t* range_set_rotate_right(range_set_node_t* node) {
+    range_set_node_t* left = node->left;
+    node->left = left->right;
+    left->right = node;
+    range_set_update(node);
+    range_set_update(left);
+    return left;
+}
 
-    bool ret = true;
-    ret = bst_check_tree(node->left);
-    ret = bst_check_tree(node->right);
-    if (node->range.start > node->range.end)
-        ret = false;
+range_set_node_t* range_set_rotate_left(range_set_node_t* node) {
+    range_set_node_t* right = node->right;
+    node->right = right->left;
+    right->left = node;
+    range_set_update(node);
+    range_set_update(right);
+    return right;
+}
 
-    if (node->left != NULL && node->range.start <= node->left->range.end) {
-        // assert(node->range.start > node->left->range.end);
-        ret = false;
+range_set_node_t* range_set_balance(range_set_node_t* node) {
+    range_set_update(node);
+    int diff = range_set_height(node->left) - range_set_height(node->right);
+    if (diff > 1) {
+        if (range_set_height(node->left->left) < range_set_height(node->left->right))
+            node->left = range_set_rotate_left(node->left);
+        return range_set_rotate_right(node);
     }
+    if (diff < -1) {
+        if (range_set_height(node->right->right) < range_set_height(node->right->left))
+            node->right = range_set_rotate_right(node->right);
+        return range_set_rotate_left(node);
+    }
+    return node;
+}
 
-    if (node->right != NULL && node->range.end >= node->right->range.start) {
-        // assert(node->range.end < node->right->range.start);
-        ret = false;
+// range must not overlap or touch anything in the tree
+range_set_node_t* range_set_node_insert(range_set_node_t* node, range_t range) {
+    if (node == NULL) {
+        range_set_node_t* new = (range_set_node_t*)malloc(sizeof(range_set_node_t));
+        new->range = range;
+        new->left = NULL;
+        new->right = NULL;
+        new->height = 1;
+        return new;
     }
-    return ret;
+    if (range.start < node->range.start)
+        node->left = range_set_node_insert(node->left, range);
+    else
+        node->right = range_set_node_insert(node->right, range);
+    return range_set_balance(node);
 }
 
-range_node_t* bst_node_insert(bst_t* bst, range_t range) {
-    if (bst->root == NULL) {
-        bst->root = bst_node_push(bst, range);
-        return bst->root;
+range_set_node_t* range_set_node_remove_min(range_set_node_t* node, range_set_node_t** min) {
+    if (node->left == NULL) {
+        *min = node;
+        return node->right;
     }
+    node->left = range_set_node_remove_min(node->left, min);
+    return range_set_balance(node);
+}
 
-    range_node_t* node = bst_node_push(bst, range);
-    bst_node_insert_recursive(bst->root, node);
-    bst_node_prune(bst->root);
-    return node;
+range_set_node_t* range_set_node_remove(range_set_node_t* node, size_t start) {
+    assert(node != NULL);
+    if (start < node->range.start) {
+        node->left = range_set_node_remove(node->left, start);
+    } else if (start > node->range.start) {
+        node->right = range_set_node_remove(node->right, start);
+    } else {
+        range_set_node_t* left = node->left;
+        range_set_node_t* right = node->right;
+        free(node);
+        if (right == NULL)
+            return left;
+        range_set_node_t* successor;
+        right = range_set_node_remove_min(right, &successor);
+        successor->left = left;
+        successor->right = right;
+        node = successor;
+    }
+    return range_set_balance(node);
 }
 
-void bst_debug_print(range_node_t* node) {
-    if (node == NULL)
-        return;
+// Any range in the tree that overlaps range, or touches it when adjacent
+// is set. The ranges in the tree are disjoint, so at most one path leads
+// to one.
+range_set_node_t* range_set_find(range_set_t* set, range_t range, bool adjacent) {
+    range_set_node_t* node = set->root;
+    while (node != NULL) {
+        bool before = range.end < node->range.start &&
+            !(adjacent && node->range.start - range.end == 1);
+        bool after = range.start > node->range.end &&
+            !(adjacent && range.start - node->range.end == 1);
+        if (before)
+            node = node->left;
+        else if (after)
+            node = node->right;
+        else
+            return node;
+    }
+    return NULL;
+}
+
+void range_set_take(range_set_t* set, range_t range) {
+    set->root = range_set_node_insert(set->root, range);
+    set->len += 1;
+    set->count += range_count(&range);
+}
 
-    bst_debug_print(node->left);
-    printf("%zu-%zu\n", node->range.start, node->range.end);
-    bst_debug_print(node->right);
+range_t range_set_drop(range_set_t* set, range_set_node_t* node) {
+    range_t range = node->range;
+    set->root = range_set_node_remove(set->root, range.start);
+    set->len -= 1;
+    set->count -= range_count(&range);
+    return range;
+}
+
+void range_set_insert(range_set_t* set, range_t range) {
+    range_set_node_t* node;
+    while ((node = range_set_find(set, range, true)) != NULL) {
+        range_t old = range_set_drop(set, node);
+        range = range_consolidate(&range, &old);
+    }
+    range_set_take(set, range);
 }
 
-size_t bst_count_ids(range_node_t* node) {
+// Removes every id in range, splitting the ranges that stick out of it.
+void range_set_remove(range_set_t* set, range_t range) {
+    range_set_node_t* node;
+    while ((node = range_set_find(set, range, false)) != NULL) {
+        range_t old = range_set_drop(set, node);
+        if (old.start < range.start)
+            range_set_take(set, (range_t){ .start = old.start, .end = range.start - 1 });
+        if (old.end > range.end)
+            range_set_take(set, (range_t){ .start = range.end + 1, .end = old.end });
+    }
+}
+
+bool range_set_contains(range_set_t* set, size_t id) {
+    range_set_node_t* node = set->root;
+    while (node != NULL) {
+        if (id < node->range.start)
+            node = node->left;
+        else if (id > node->range.end)
+            node = node->right;
+        else
+            return true;
+    }
+    return false;
+}
+
+size_t range_set_count_ids(range_set_t* set) {
+    return set->count;
+}
+
+// Checks ordering, spacing and balance, returns the height.
+int range_set_check(range_set_node_t* node, range_t* prev) {
     if (node == NULL)
         return 0;
-    size_t left_count = bst_count_ids(node->left);
-    size_t right_count = bst_count_ids(node->right);
-    size_t node_count = range_count(&node->range);
-    return left_count + node_count + right_count;
-}
-
-void test_bst() {
-    bst_t* bst = bst_create(12);
-    bst_node_insert(bst, (range_t){ .start = 3, .end = 5 } );
-    assert(bst->root != NULL);
-    bst_check_tree(bst->root);
-    assert(bst->root->range.start == 3 && bst->root->range.end == 5);
-    bst_node_insert(bst, (range_t){ .start = 10, .end = 14 } );
-    assert(bst->root->right->range.start == 10 && bst->root->right->range.end == 14);
-    bst_check_tree(bst->root);
-    bst_node_insert(bst, (range_t){ .start = 16, .end = 20 } );
-    assert(bst->root->right->right->range.start == 16 && bst->root->right->right->range.end == 20);
-    bst_check_tree(bst->root);
-    bst_node_insert(bst, (range_t){ .start = 12, .end = 18 } );
-    bst_check_tree(bst->root);
-
-    assert(bst->root->right->range.start == 10 && bst->root->right->range.end == 20);
-    assert(bst_count_ids(bst->root) == 14);
-
-
-    bst_node_insert(bst, (range_t){
-            .start = 1151221132517,
-            .end   = 1356033568084 });
-    bst_node_insert(bst, (range_t){ 
-            .start = 447008091749,
-            .end = 1670555330556 });
-    bst_check_tree(bst->root);
-    bst_node_insert(bst, (range_t){
-            .start = 12345,
-            .end   = 15000 });
-    bst_node_insert(bst, (range_t){ 
-            .start = 12345,
-            .end   = 15001 });
+    int left = range_set_check(node->left, prev);
+    assert(node->range.start <= node->range.end);
+    if (prev->start <= prev->end)
+        assert(node->range.start > prev->end && node->range.start - prev->end > 1);
+    *prev = node->range;
+    int right = range_set_check(node->right, prev);
+    assert(left - right <= 1 && right - left <= 1);
+    assert(node->height == 1 + (left > right ? left : right));
+    return node->height;
+}
 
-    // 60627233829569-67301045866627
-    // 67014797628214-70234710680711
-    // These aren't merging in the input2.txt case
-    bst_node_insert(bst, (range_t){ 
-            .start = 60627233829569,
-            .end   = 67301045866627 });
-    bst_node_insert(bst, (range_t){ 
-            .start = 67014797628214,
-            .end   = 70234710680711 });
-    bst_check_tree(bst->root);
-    bst_debug_print(bst->root);
-    printf("test_bst passed.\n");
-    assert(false);
+void test_range_set() {
+    range_set_t* set = range_set_create();
+    range_set_insert(set, (range_t){ .start = 3, .end = 5 });
+    range_set_insert(set, (range_t){ .start = 10, .end = 14 });
+    range_set_insert(set, (range_t){ .start = 16, .end = 20 });
+    range_set_insert(set, (range_t){ .start = 12, .end = 18 });
+    assert(set->len == 2 && range_set_count_ids(set) == 14);
+    range_set_insert(set, (range_t){ .start = 6, .end = 9 });      // touches both
+    assert(set->len == 1 && range_set_count_ids(set) == 18);
+
+    range_set_remove(set, (range_t){ .start = 8, .end = 10 });
+    assert(set->len == 2 && range_set_count_ids(set) == 15);
+    assert(range_set_contains(set, 7) && !range_set_contains(set, 8));
+    assert(!range_set_contains(set, 10) && range_set_contains(set, 11));
+    range_set_remove(set, (range_t){ .start = 0, .end = 100 });
+    assert(set->len == 0 && set->root == NULL && range_set_count_ids(set) == 0);
+
+    // these two didn't merge in the old bst
+    range_set_insert(set, (range_t){ .start = 60627233829569, .end = 67301045866627 });
+    range_set_insert(set, (range_t){ .start = 67014797628214, .end = 70234710680711 });
+    assert(set->len == 1 && set->root->range.start == 60627233829569 &&
+            set->root->range.end == 70234710680711);
+    range_set_insert(set, (range_t){ .start = SIZE_MAX - 1, .end = SIZE_MAX });
+    range_set_insert(set, (range_t){ .start = 0, .end = 0 });
+    range_set_remove(set, (range_t){ .start = SIZE_MAX, .end = SIZE_MAX });
+    range_set_remove(set, (range_t){ .start = 0, .end = 0 });
+    assert(set->len == 2 && range_set_contains(set, SIZE_MAX - 1));
+    range_set_free(set);
+
+    // random inserts and removes against a bitmap of the same ids
+    enum { UNIVERSE = 2000 };
+    bool fresh[UNIVERSE] = { false };
+    uint64_t seed = 0x5e7;
+    set = range_set_create();
+    for (int op = 0; op < 4000; op++) {
+        size_t start = next_random(&seed) % UNIVERSE;
+        size_t span = next_random(&seed) % (op % 3 ? 20 : 200);
+        size_t end = start + span < UNIVERSE ? start + span : UNIVERSE - 1;
+        bool add = next_random(&seed) % 3 != 0;
+        if (add)
+            range_set_insert(set, (range_t){ .start = start, .end = end });
+        else
+            range_set_remove(set, (range_t){ .start = start, .end = end });
+        for (size_t id = start; id <= end; id++)
+            fresh[id] = add;
+
+        if (op % 50 == 0) {
+            range_t prev = { .start = 1, .end = 0 };
+            range_set_check(set->root, &prev);
+            size_t expected = 0;
+            for (size_t id = 0; id < UNIVERSE; id++) {
+                assert(range_set_contains(set, id) == fresh[id]);
+                expected += fresh[id];
+            }
+            assert(range_set_count_ids(set) == expected);
+        }
+    }
+    range_set_free(set);
+    printf("test_range_set passed.\n");
 }
 
 typedef struct list_node list_node_t;
@@ -540,109 +797,2063 @@ void test_range_list() {
     printf("test_range_list passed.\n");
 }
 
-int find_char(const char* buf, char c) {
-    int offset = 0;
-    while (*(buf + offset) != '\0' && !isspace(*(buf + offset))) {
-        if (*(buf + offset) == c)
-            return offset;
-        offset++;
+void test_range_sort() {
+    uint64_t seed = 0x5eed;
+    size_t lens[] = { 0, 1, 7, 63, 64, 1000, 5000 };
+    for (size_t t = 0; t < sizeof(lens) / sizeof(lens[0]); t++) {
+        size_t len = lens[t];
+        range_t* ranges = (range_t*)malloc(sizeof(range_t) * (len + 1));
+        range_t* expected = (range_t*)malloc(sizeof(range_t) * (len + 1));
+        range_list_t* list = range_list_create(len + 1);
+        for (size_t i = 0; i < len; i++) {
+            // alternate between small and full-width starts
+            size_t start = next_random(&seed);
+            if (i % 2)
+                start %= 100000;
+            size_t span = next_random(&seed) % 1000;
+            ranges[i] = (range_t){ .start = start, .end = start > SIZE_MAX - span ? SIZE_MAX : start + span };
+            expected[i] = ranges[i];
+            range_list_push_sorted(list, ranges[i]);
+        }
+        qsort(expected, len, sizeof(range_t), range_compare_start);
+        range_sort(ranges, len);
+        for (size_t i = 0; i < len; i++)
+            assert(ranges[i].start == expected[i].start);
+
+        size_t merged = range_merge_sorted(ranges, len);
+        size_t count = 0;
+        for (size_t i = 0; i < merged; i++) {
+            if (i > 0)
+                assert(ranges[i].start > ranges[i - 1].end + 1);
+            count += range_count(&ranges[i]);
+        }
+        if (len > 0) {
+            range_list_merge(list);
+            assert(count == range_list_count_ids(list));
+        }
+        range_list_free(list);
+        free(expected);
+        free(ranges);
     }
-    offset = -1;
-    printf("\n");
-    return offset;
+    printf("test_range_sort passed.\n");
+}
+
+void test_range_batch() {
+    uint64_t seed = 0xba7c4;
+    range_array_t* arr = range_array_create(64);
+    for (size_t i = 0; i < 500; i++) {
+        size_t start = next_random(&seed) % 1000000;
+        range_array_add_range(arr, start, start + next_random(&seed) % 500);
+    }
+    range_index_t* index = range_index_create(arr);
+
+    size_t lens[] = { 0, 1, 10, 5000 };
+    for (size_t t = 0; t < sizeof(lens) / sizeof(lens[0]); t++) {
+        size_t len = lens[t];
+        size_t* ids = (size_t*)malloc(sizeof(size_t) * (len + 1));
+        size_t expected = 0;
+        for (size_t i = 0; i < len; i++) {
+            ids[i] = next_random(&seed) % 1100000;
+            if (i % 7 == 0)
+                ids[i] = next_random(&seed);        // far past every range
+            expected += range_index_contains(index, ids[i]);
+        }
+        assert(range_index_count_batch(index, ids, len) == expected);
+        for (size_t i = 1; i < len; i++)
+            assert(ids[i - 1] <= ids[i]);
+        free(ids);
+    }
+
+    range_index_free(index);
+    range_array_free(arr);
+    printf("test_range_batch passed.\n");
+}
+
+// Set algebra on merged indexes, each a single two-pointer pass. The
+// results are merged indexes too, so their id totals come from
+// range_index_count_ids without listing any ids.
+range_index_t* range_index_alloc(size_t cap) {
+    range_index_t* index = (range_index_t*)malloc(sizeof(range_index_t));
+    index->ranges = (range_t*)malloc(sizeof(range_t) * (cap ? cap : 1));
+    index->len = 0;
+    return index;
+}
+
+// Appends a range that doesn't start before the last one, merging them if
+// they overlap or touch.
+void range_index_push(range_index_t* index, range_t range) {
+    range_t* last = index->len ? &index->ranges[index->len - 1] : NULL;
+    if (last != NULL && range_mergeable(last, &range)) {
+        if (range.end > last->end)
+            last->end = range.end;
+    } else {
+        index->ranges[index->len++] = range;
+    }
+}
+
+range_index_t* range_index_union(range_index_t* a, range_index_t* b) {
+    range_index_t* out = range_index_alloc(a->len + b->len);
+    size_t i = 0, j = 0;
+    while (i < a->len || j < b->len) {
+        if (j == b->len || (i < a->len && a->ranges[i].start <= b->ranges[j].start))
+            range_index_push(out, a->ranges[i++]);
+        else
+            range_index_push(out, b->ranges[j++]);
+    }
+    return out;
+}
+
+range_index_t* range_index_intersection(range_index_t* a, range_index_t* b) {
+    range_index_t* out = range_index_alloc(a->len + b->len);
+    size_t i = 0, j = 0;
+    while (i < a->len && j < b->len) {
+        range_t* ra = &a->ranges[i];
+        range_t* rb = &b->ranges[j];
+        size_t start = ra->start > rb->start ? ra->start : rb->start;
+        size_t end = ra->end < rb->end ? ra->end : rb->end;
+        if (start <= end)
+            out->ranges[out->len++] = (range_t){ .start = start, .end = end };
+        // whichever ends first can't meet anything further on
+        if (ra->end < rb->end)
+            i++;
+        else
+            j++;
+    }
+    return out;
+}
+
+// Ids in a but not in b.
+range_index_t* range_index_difference(range_index_t* a, range_index_t* b) {
+    range_index_t* out = range_index_alloc(a->len + b->len);
+    size_t j = 0;
+    for (size_t i = 0; i < a->len; i++) {
+        range_t r = a->ranges[i];
+        bool left = true;   // some of r is still uncovered
+        while (j < b->len && b->ranges[j].end < r.start)
+            j++;
+        // b->ranges[j] may reach into the next range of a, so j stays on
+        // the last one that overlaps r
+        for (size_t k = j; k < b->len && b->ranges[k].start <= r.end; k++) {
+            range_t* cut = &b->ranges[k];
+            if (cut->start > r.start)
+                out->ranges[out->len++] = (range_t){ .start = r.start, .end = cut->start - 1 };
+            if (cut->end >= r.end) {
+                left = false;
+                break;
+            }
+            r.start = cut->end + 1;
+            j = k + 1;
+        }
+        if (left)
+            out->ranges[out->len++] = r;
+    }
+    return out;
+}
+
+// Ids in exactly one of a and b.
+range_index_t* range_index_symmetric_difference(range_index_t* a, range_index_t* b) {
+    range_index_t* a_only = range_index_difference(a, b);
+    range_index_t* b_only = range_index_difference(b, a);
+    range_index_t* out = range_index_union(a_only, b_only);
+    range_index_free(a_only);
+    range_index_free(b_only);
+    return out;
+}
+
+void test_range_algebra() {
+    enum { UNIVERSE = 600 };
+    uint64_t seed = 0xa19;
+    for (int t = 0; t < 200; t++) {
+        bool in_a[UNIVERSE] = { false };
+        bool in_b[UNIVERSE] = { false };
+        range_array_t* arr_a = range_array_create(8);
+        range_array_t* arr_b = range_array_create(8);
+        size_t num_a = next_random(&seed) % 12, num_b = next_random(&seed) % 12;
+        for (size_t k = 0; k < num_a + num_b; k++) {
+            size_t start = next_random(&seed) % (UNIVERSE - 60);
+            size_t end = start + next_random(&seed) % 60;
+            range_array_add_range(k < num_a ? arr_a : arr_b, start, end);
+            for (size_t id = start; id <= end; id++)
+                (k < num_a ? in_a : in_b)[id] = true;
+        }
+        range_index_t* a = range_index_create(arr_a);
+        range_index_t* b = range_index_create(arr_b);
+        range_index_t* results[4] = {
+            range_index_union(a, b),
+            range_index_intersection(a, b),
+            range_index_difference(a, b),
+            range_index_symmetric_difference(a, b),
+        };
+        size_t expected[4] = { 0 };
+        for (size_t id = 0; id < UNIVERSE; id++) {
+            bool want[4] = { in_a[id] || in_b[id], in_a[id] && in_b[id], in_a[id] && !in_b[id], in_a[id] != in_b[id] };
+            for (int op = 0; op < 4; op++) {
+                assert(range_index_contains(results[op], id) == want[op]);
+                expected[op] += want[op];
+            }
+        }
+        for (int op = 0; op < 4; op++) {
+            assert(range_index_count_ids(results[op]) == expected[op]);
+            for (size_t k = 1; k < results[op]->len; k++)
+                assert(results[op]->ranges[k].start > results[op]->ranges[k - 1].end + 1);
+            range_index_free(results[op]);
+        }
+        range_index_free(a);
+        range_index_free(b);
+        range_array_free(arr_a);
+        range_array_free(arr_b);
+    }
+
+    // ranges reaching both ends of the id space
+    range_t all = { .start = 0, .end = SIZE_MAX };
+    range_t mid = { .start = 10, .end = 20 };
+    range_t edge = { .start = SIZE_MAX, .end = SIZE_MAX };
+    range_index_t a = { .ranges = &all, .len = 1 };
+    range_index_t b = { .ranges = &mid, .len = 1 };
+    range_index_t c = { .ranges = &edge, .len = 1 };
+    range_index_t* d = range_index_difference(&a, &b);
+    assert(d->len == 2 && d->ranges[0].end == 9 && d->ranges[1].start == 21 && d->ranges[1].end == SIZE_MAX);
+    range_index_free(d);
+    d = range_index_difference(&a, &c);
+    assert(d->len == 1 && d->ranges[0].end == SIZE_MAX - 1);
+    range_index_free(d);
+    d = range_index_difference(&c, &a);
+    assert(d->len == 0);
+    range_index_free(d);
+    printf("test_range_algebra passed.\n");
+}
+
+// The merged ranges again, in Eytzinger order: an implicit binary tree
+// laid out breadth first, node k has children 2k and 2k+1 (1-based). The
+// top of the tree shares a few cache lines and the 8 great-grandchildren
+// of a node sit in one line, so the search prefetches 3 levels ahead and
+// the only branch is the loop, whose trip count depends on len alone.
+#define EYTZINGER_PREFETCH 8
+
+typedef struct {
+    size_t* starts;     // len + 1 slots, slot 0 unused
+    size_t* ends;
+    size_t len;
+} range_eytzinger_t;
+
+size_t range_eytzinger_fill(range_eytzinger_t* tree, const range_t* sorted, size_t i, size_t k) {
+    if (k <= tree->len) {
+        i = range_eytzinger_fill(tree, sorted, i, 2 * k);
+        tree->starts[k] = sorted[i].start;
+        tree->ends[k]   = sorted[i].end;
+        i = range_eytzinger_fill(tree, sorted, i + 1, 2 * k + 1);
+    }
+    return i;
+}
+
+range_eytzinger_t* range_eytzinger_create(range_index_t* index) {
+    range_eytzinger_t* tree = (range_eytzinger_t*)malloc(sizeof(range_eytzinger_t));
+    // whole cache lines, so starts[8k..8k+7] is always one line
+    size_t bytes = ((index->len + 1) * sizeof(size_t) + 63) & ~(size_t)63;
+    tree->starts = (size_t*)aligned_alloc(64, bytes);
+    tree->ends = (size_t*)aligned_alloc(64, bytes);
+    tree->len = index->len;
+    tree->starts[0] = 0;
+    tree->ends[0] = 0;
+    range_eytzinger_fill(tree, index->ranges, 0, 1);
+    return tree;
+}
+
+void range_eytzinger_free(range_eytzinger_t* tree) {
+    free(tree->starts);
+    free(tree->ends);
+    tree->starts = NULL;
+    tree->ends = NULL;
+    tree->len = 0;
+    free(tree);
+}
+
+bool range_eytzinger_contains(range_eytzinger_t* tree, size_t id) {
+    // the last node where the search went right holds the largest start <= id
+    size_t k = 1;
+    size_t last = 0;
+    while (k <= tree->len) {
+        __builtin_prefetch(tree->starts + k * EYTZINGER_PREFETCH);
+        bool right = tree->starts[k] <= id;
+        last = right ? k : last;
+        k = 2 * k + right;
+    }
+    return last != 0 && id <= tree->ends[last];
+}
+
+void test_range_eytzinger() {
+    uint64_t seed = 0xe472;
+    size_t lens[] = { 0, 1, 2, 7, 8, 9, 1000, 4095 };
+    for (size_t t = 0; t < sizeof(lens) / sizeof(lens[0]); t++) {
+        range_array_t* arr = range_array_create(lens[t] + 1);
+        size_t start = 5;
+        for (size_t i = 0; i < lens[t]; i++) {
+            size_t end = start + next_random(&seed) % 4;
+            range_array_add_range(arr, start, end);
+            start = end + 2 + next_random(&seed) % 4;
+        }
+        range_index_t* index = range_index_create(arr);
+        assert(index->len == lens[t]);
+        range_eytzinger_t* tree = range_eytzinger_create(index);
+        for (size_t id = 0; id < start + 3; id++)
+            assert(range_eytzinger_contains(tree, id) == range_index_contains(index, id));
+        assert(!range_eytzinger_contains(tree, SIZE_MAX));
+        range_eytzinger_free(tree);
+        range_index_free(index);
+        range_array_free(arr);
+    }
+    printf("test_range_eytzinger passed.\n");
+}
+
+double seconds_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+#define BENCH_LOOKUPS (1 << 22)
+
+// --bench-lookup[=E]: binary search against the Eytzinger layout for
+// 10^3 to 10^E disjoint random ranges (E defaults to 8), as CSV. The
+// ranges and query ids are generated, about half of the ids are fresh.
+void bench_lookup(int max_exp) {
+    uint64_t seed = 0x100c;
+    size_t* ids = (size_t*)malloc(sizeof(size_t) * BENCH_LOOKUPS);
+
+    printf("intervals,layout,ns_per_lookup,mlookups_per_sec,fresh\n");
+    size_t len = 1000;
+    for (int exp = 3; exp <= max_exp; exp++, len *= 10) {
+        range_index_t index = {
+            .ranges = (range_t*)malloc(sizeof(range_t) * len),
+            .len = len,
+        };
+        size_t start = 0;
+        for (size_t i = 0; i < len; i++) {
+            size_t span = next_random(&seed) % 1000;
+            index.ranges[i] = (range_t){ .start = start, .end = start + span };
+            start += 2 * span + 2;
+        }
+        for (size_t i = 0; i < BENCH_LOOKUPS; i++)
+            ids[i] = next_random(&seed) % start;
+        range_eytzinger_t* tree = range_eytzinger_create(&index);
+
+        double t0 = seconds_now();
+        size_t fresh_search = 0;
+        for (size_t i = 0; i < BENCH_LOOKUPS; i++)
+            fresh_search += range_index_contains(&index, ids[i]);
+        double t1 = seconds_now();
+        size_t fresh_tree = 0;
+        for (size_t i = 0; i < BENCH_LOOKUPS; i++)
+            fresh_tree += range_eytzinger_contains(tree, ids[i]);
+        double t2 = seconds_now();
+        assert(fresh_search == fresh_tree);
+
+        printf("%zu,binary_search,%.1f,%.2f,%zu\n", len, (t1 - t0) * 1e9 / BENCH_LOOKUPS,
+                BENCH_LOOKUPS / (t1 - t0) / 1e6, fresh_search);
+        printf("%zu,eytzinger,%.1f,%.2f,%zu\n", len, (t2 - t1) * 1e9 / BENCH_LOOKUPS,
+                BENCH_LOOKUPS / (t2 - t1) / 1e6, fresh_tree);
+        fflush(stdout);
+
+        range_eytzinger_free(tree);
+        free(index.ranges);
+    }
+    free(ids);
+}
+
+// Parallel sort and merge for very long range lists. Each thread sorts
+// and merges its own chunk, then the chunks are merged by key range: a
+// sample of their starts picks one splitter per thread, every thread
+// heap-merges the pieces of all chunks that fall in its key range into its
+// own slice of the output and merges that slice. A last sequential pass
+// joins the slices, coalescing ranges that reach across a splitter.
+#define PARALLEL_MIN_RANGES (1 << 16)
+#define PARALLEL_SAMPLES 64
+
+typedef struct {
+    range_t* ranges;
+    size_t len;
+} range_run_t;
+
+typedef struct {
+    range_run_t* runs;      // every chunk, sorted and merged
+    size_t num_runs;
+    size_t* begin;          // this slice's piece of run r: [begin[r], end[r])
+    size_t* end;
+    range_t* out;
+    size_t len;             // set by the phase that ran last
+} __attribute__((aligned(64))) merge_worker_t;
+
+void* sort_chunk_worker(void* arg) {
+    range_run_t* run = (range_run_t*)arg;
+    range_sort(run->ranges, run->len);
+    run->len = range_merge_sorted(run->ranges, run->len);
+    return NULL;
+}
+
+// k-way merge through a binary min-heap of run heads.
+void* merge_slice_worker(void* arg) {
+    merge_worker_t* worker = (merge_worker_t*)arg;
+    size_t k = worker->num_runs;
+    size_t* heap = (size_t*)malloc(sizeof(size_t) * k);
+    size_t* next = (size_t*)malloc(sizeof(size_t) * k);
+    size_t size = 0;
+    for (size_t r = 0; r < k; r++) {
+        next[r] = worker->begin[r];
+        if (next[r] < worker->end[r])
+            heap[size++] = r;
+    }
+
+#define HEAD(r) (worker->runs[r].ranges[next[r]].start)
+    for (size_t i = size / 2; i-- > 0;) {
+        for (size_t at = i;;) {
+            size_t min = at, l = 2 * at + 1, r = l + 1;
+            if (l < size && HEAD(heap[l]) < HEAD(heap[min])) min = l;
+            if (r < size && HEAD(heap[r]) < HEAD(heap[min])) min = r;
+            if (min == at) break;
+            size_t tmp = heap[at]; heap[at] = heap[min]; heap[min] = tmp;
+            at = min;
+        }
+    }
+
+    size_t len = 0;
+    while (size > 0) {
+        size_t run = heap[0];
+        worker->out[len++] = worker->runs[run].ranges[next[run]++];
+        if (next[run] == worker->end[run])
+            heap[0] = heap[--size];
+        for (size_t at = 0;;) {
+            size_t min = at, l = 2 * at + 1, r = l + 1;
+            if (l < size && HEAD(heap[l]) < HEAD(heap[min])) min = l;
+            if (r < size && HEAD(heap[r]) < HEAD(heap[min])) min = r;
+            if (min == at) break;
+            size_t tmp = heap[at]; heap[at] = heap[min]; heap[min] = tmp;
+            at = min;
+        }
+    }
+#undef HEAD
+
+    worker->len = range_merge_sorted(worker->out, len);
+    free(next);
+    free(heap);
+    return NULL;
+}
+
+// First index in run with start >= key.
+size_t range_run_lower_bound(range_run_t* run, size_t key) {
+    size_t lo = 0, hi = run->len;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (run->ranges[mid].start < key)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+int size_compare(const void* a, const void* b) {
+    size_t x = *(const size_t*)a, y = *(const size_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+range_index_t* range_index_create_parallel(range_array_t* arr, size_t num_threads) {
+    if (num_threads > arr->len / PARALLEL_MIN_RANGES)
+        num_threads = arr->len / PARALLEL_MIN_RANGES;
+    if (num_threads <= 1)
+        return range_index_create(arr);
+
+    size_t n = arr->len;
+    range_t* chunks = (range_t*)malloc(sizeof(range_t) * n);
+    memcpy(chunks, arr->ptr, sizeof(range_t) * n);
+    pthread_t* threads = (pthread_t*)malloc(sizeof(pthread_t) * num_threads);
+    range_run_t* runs = (range_run_t*)malloc(sizeof(range_run_t) * num_threads);
+    for (size_t t = 0; t < num_threads; t++) {
+        size_t lo = n * t / num_threads, hi = n * (t + 1) / num_threads;
+        runs[t] = (range_run_t){ .ranges = chunks + lo, .len = hi - lo };
+        pthread_create(&threads[t], NULL, sort_chunk_worker, &runs[t]);
+    }
+    for (size_t t = 0; t < num_threads; t++)
+        pthread_join(threads[t], NULL);
+
+    // splitters: quantiles of an even sample from every run
+    size_t num_samples = 0;
+    size_t* samples = (size_t*)malloc(sizeof(size_t) * num_threads * PARALLEL_SAMPLES);
+    for (size_t t = 0; t < num_threads; t++) {
+        for (size_t i = 0; i < PARALLEL_SAMPLES && runs[t].len > 0; i++)
+            samples[num_samples++] = runs[t].ranges[runs[t].len * i / PARALLEL_SAMPLES].start;
+    }
+    qsort(samples, num_samples, sizeof(size_t), size_compare);
+
+    // cuts[t * k + r]: where slice t starts in run r
+    size_t k = num_threads;
+    size_t* cuts = (size_t*)malloc(sizeof(size_t) * (num_threads + 1) * k);
+    for (size_t r = 0; r < k; r++) {
+        cuts[r] = 0;
+        cuts[num_threads * k + r] = runs[r].len;
+    }
+    for (size_t t = 1; t < num_threads; t++) {
+        size_t splitter = samples[num_samples * t / num_threads];
+        for (size_t r = 0; r < k; r++)
+            cuts[t * k + r] = range_run_lower_bound(&runs[r], splitter);
+    }
+
+    range_index_t* index = range_index_alloc(n);
+    merge_worker_t* workers = (merge_worker_t*)aligned_alloc(64, sizeof(merge_worker_t) * num_threads);
+    size_t offset = 0;
+    for (size_t t = 0; t < num_threads; t++) {
+        workers[t] = (merge_worker_t){
+            .runs = runs,
+            .num_runs = k,
+            .begin = cuts + t * k,
+            .end = cuts + (t + 1) * k,
+            .out = index->ranges + offset,
+        };
+        for (size_t r = 0; r < k; r++)
+            offset += workers[t].end[r] - workers[t].begin[r];
+        pthread_create(&threads[t], NULL, merge_slice_worker, &workers[t]);
+    }
+    for (size_t t = 0; t < num_threads; t++)
+        pthread_join(threads[t], NULL);
+
+    // join the slices, only their first ranges can merge with what's before
+    for (size_t t = 0; t < num_threads; t++) {
+        range_t* slice = workers[t].out;
+        size_t i = 0;
+        while (i < workers[t].len && index->len > 0
+                && range_mergeable(&index->ranges[index->len - 1], &slice[i]))
+            range_index_push(index, slice[i++]);
+        memmove(index->ranges + index->len, slice + i, sizeof(range_t) * (workers[t].len - i));
+        index->len += workers[t].len - i;
+    }
+
+    free(workers);
+    free(cuts);
+    free(samples);
+    free(runs);
+    free(threads);
+    free(chunks);
+    return index;
+}
+
+void test_range_parallel() {
+    uint64_t seed = 0x9a7;
+    size_t lens[] = { 10, 3 * PARALLEL_MIN_RANGES + 17, 9 * PARALLEL_MIN_RANGES };
+    for (size_t t = 0; t < sizeof(lens) / sizeof(lens[0]); t++) {
+        range_array_t* arr = range_array_create(lens[t]);
+        for (size_t i = 0; i < lens[t]; i++) {
+            // a few long ranges cross many splitters
+            size_t start = next_random(&seed) % 100000000;
+            size_t span = i % 1000 == 0 ? 20000000 : next_random(&seed) % 400;
+            range_array_add_range(arr, start, start + span);
+        }
+        if (t == 2) {
+            // every start equal: all splitters are the same key
+            for (size_t i = 0; i < arr->len; i++)
+                arr->ptr[i].start = 5;
+        }
+        range_index_t* expected = range_index_create(arr);
+        for (size_t threads = 1; threads <= 9; threads += 4) {
+            range_index_t* index = range_index_create_parallel(arr, threads);
+            assert(index->len == expected->len);
+            assert(memcmp(index->ranges, expected->ranges, sizeof(range_t) * index->len) == 0);
+            range_index_free(index);
+        }
+        range_index_free(expected);
+        range_array_free(arr);
+    }
+    printf("test_range_parallel passed.\n");
 }
 
-size_t string_to_id(const char* buf, int start, int end) {
+typedef struct {
+    const char* data;
+    size_t size;
+} mapped_input_t;
+
+mapped_input_t* mapped_input_open(const char* filename) {
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        printf("FAILED TO OPEN INPUT FILE.\n");
+        exit(-1);
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        printf("EMPTY INPUT FILE.\n");
+        exit(-1);
+    }
+
+    mapped_input_t* input = (mapped_input_t*)malloc(sizeof(mapped_input_t));
+    input->size = (size_t)st.st_size;
+    input->data = (const char*)mmap(NULL, input->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (input->data == MAP_FAILED) {
+        printf("FAILED TO MAP INPUT FILE.\n");
+        exit(-1);
+    }
+    madvise((void*)input->data, input->size, MADV_SEQUENTIAL);
+    return input;
+}
+
+void mapped_input_close(mapped_input_t* input) {
+    munmap((void*)input->data, input->size);
+    free(input);
+}
+
+// Reads the digits at p into *id, returns the first byte after them. An id
+// too big for a size_t stops at the digit that would overflow, so callers
+// see a digit where they expect a delimiter and reject the line.
+const char* parse_id(const char* p, const char* end, size_t* id) {
     size_t accum = 0;
-    for (int i = start; i < end; i++) {
-        int digit = buf[i] - '0';
+    while (p < end && (unsigned)(*p - '0') < 10) {
+        size_t digit = (size_t)(*p - '0');
+        if (accum > (SIZE_MAX - digit) / 10)
+            break;
         accum = accum * 10 + digit;
+        p++;
     }
-    return accum;
+    *id = accum;
+    return p;
 }
 
-int main() {
-    test_range();
-    // test_bst();
-    test_range_list();
-    // exit(1);
-    const char* input_name = "input.txt";
-    FILE* file = fopen(input_name, "r");
+// Skips a \n or \r\n line ending, NULL if p is at anything else.
+const char* skip_newline(const char* p, const char* end) {
+    if (p < end && *p == '\r')
+        p++;
+    if (p == end)
+        return p;
+    return *p == '\n' ? p + 1 : NULL;
+}
+
+// Parses the "start-end" lines up to the first blank line. *ids is set to
+// where the id section starts, or to the end of the data if there is none.
+range_array_t* parse_ranges(const char* data, size_t size, size_t* ids) {
+    const char* p = data;
+    const char* end = data + size;
+    range_array_t* arr = range_array_create(256);
+    size_t line = 1;
+    while (p < end) {
+        const char* blank = skip_newline(p, end);
+        if (blank != NULL) {
+            p = blank;
+            break;
+        }
+        size_t start, stop;
+        const char* dash = parse_id(p, end, &start);
+        const char* after = dash < end && *dash == '-' ? parse_id(dash + 1, end, &stop) : NULL;
+        const char* next = after != NULL ? skip_newline(after, end) : NULL;
+        if (dash == p || after == dash + 1 || next == NULL || start > stop) {
+            printf("BAD RANGE ON LINE %zu.\n", line);
+            exit(-1);
+        }
+        range_array_add_range(arr, start, stop);
+        p = next;
+        line++;
+    }
+    *ids = (size_t)(p - data);
+    return arr;
+}
+
+void bad_id_line(const char* line, const char* end) {
+    const char* newline = memchr(line, '\n', end - line);
+    int len = (int)((newline ? newline : end) - line);
+    printf("BAD ID LINE '%.*s'.\n", len > 40 ? 40 : len, line);
+    exit(-1);
+}
+
+// Checks the ids in [p, end) one per line as they are parsed. Blank lines
+// are skipped, p must be at the start of a line.
+size_t count_fresh_ids(range_eytzinger_t* tree, const char* p, const char* end) {
+    size_t fresh = 0;
+    while (p < end) {
+        size_t id;
+        const char* after = parse_id(p, end, &id);
+        const char* next = skip_newline(after, end);
+        if (next == NULL)
+            bad_id_line(p, end);
+        if (after != p)
+            fresh += range_eytzinger_contains(tree, id);
+        p = next;
+    }
+    return fresh;
+}
+
+// Same as count_fresh_ids, but the ids are collected first and checked in
+// one merge-join, see range_index_count_batch.
+size_t count_fresh_ids_batch(range_index_t* index, const char* p, const char* end) {
+    size_t cap = 1024;
+    size_t len = 0;
+    size_t* ids = (size_t*)malloc(sizeof(size_t) * cap);
+    while (p < end) {
+        size_t id;
+        const char* after = parse_id(p, end, &id);
+        const char* next = skip_newline(after, end);
+        if (next == NULL)
+            bad_id_line(p, end);
+        if (after != p) {
+            if (len >= cap) {
+                cap *= 2;
+                ids = (size_t*)realloc(ids, sizeof(size_t) * cap);
+            }
+            ids[len++] = id;
+        }
+        p = next;
+    }
+    size_t fresh = range_index_count_batch(index, ids, len);
+    free(ids);
+    return fresh;
+}
+
+// Below this many bytes of ids per thread, extra threads cost more than
+// they save.
+#define ID_CHUNK_MIN (1 << 16)
+
+typedef struct {
+    range_eytzinger_t* tree;
+    const char* begin;
+    const char* end;
+    size_t fresh;
+} __attribute__((aligned(64))) id_chunk_t;
+
+void* id_chunk_worker(void* arg) {
+    id_chunk_t* chunk = (id_chunk_t*)arg;
+    chunk->fresh = count_fresh_ids(chunk->tree, chunk->begin, chunk->end);
+    return NULL;
+}
+
+// Splits the id section into one chunk per thread, each cut moved forward
+// to just past a newline so every chunk holds whole lines. The tree is
+// only read and each thread counts into its own cache line.
+size_t count_fresh_ids_parallel(range_eytzinger_t* tree, const char* begin, const char* end, size_t num_threads) {
+    size_t bytes = (size_t)(end - begin);
+    if (num_threads > bytes / ID_CHUNK_MIN + 1)
+        num_threads = bytes / ID_CHUNK_MIN + 1;
+    if (num_threads <= 1)
+        return count_fresh_ids(tree, begin, end);
+
+    pthread_t* threads = (pthread_t*)malloc(sizeof(pthread_t) * num_threads);
+    id_chunk_t* chunks = (id_chunk_t*)aligned_alloc(64, sizeof(id_chunk_t) * num_threads);
+    const char* cut = begin;
+    for (size_t i = 0; i < num_threads; i++) {
+        const char* next = begin + bytes * (i + 1) / num_threads;
+        if (next < cut)
+            next = cut;
+        if (i + 1 < num_threads && next > begin && next < end && next[-1] != '\n') {
+            const char* newline = memchr(next, '\n', end - next);
+            next = newline ? newline + 1 : end;
+        }
+        chunks[i] = (id_chunk_t){ .tree = tree, .begin = cut, .end = next, .fresh = 0 };
+        pthread_create(&threads[i], NULL, id_chunk_worker, &chunks[i]);
+        cut = next;
+    }
+
+    size_t fresh = 0;
+    for (size_t i = 0; i < num_threads; i++) {
+        pthread_join(threads[i], NULL);
+        fresh += chunks[i].fresh;
+    }
+    free(chunks);
+    free(threads);
+    return fresh;
+}
+
+void test_parse() {
+    const char* text = "3-5\r\n10-14\n16-20\n12-18\n\n1\n5\r\n8\n\n11\n17\n32";
+    size_t size = strlen(text);
+    size_t ids;
+    range_array_t* arr = parse_ranges(text, size, &ids);
+    assert(arr->len == 4);
+    assert(arr->ptr[0].start == 3 && arr->ptr[0].end == 5);
+    assert(arr->ptr[3].start == 12 && arr->ptr[3].end == 18);
+    assert(strncmp(text + ids, "1\n5", 3) == 0);
+
+    range_index_t* index = range_index_create(arr);
+    range_eytzinger_t* tree = range_eytzinger_create(index);
+    assert(range_index_count_ids(index) == 14);
+    assert(count_fresh_ids(tree, text + ids, text + size) == 3);
+    assert(count_fresh_ids_batch(index, text + ids, text + size) == 3);
+    range_eytzinger_free(tree);
+    range_index_free(index);
+    range_array_free(arr);
+
+    // enough ids for every thread count to get several chunks
+    size_t cap = 16 * ID_CHUNK_MIN;
+    char* many = (char*)malloc(cap + 32);
+    size_t len = 0;
+    size_t expected = 0;
+    uint64_t seed = 0x1d5;
+    arr = range_array_create(8);
+    range_array_add_range(arr, 1000, 1999);
+    range_array_add_range(arr, 5000, 5000);
+    index = range_index_create(arr);
+    tree = range_eytzinger_create(index);
+    while (len < cap) {
+        size_t id = next_random(&seed) % 6000;
+        expected += range_index_contains(index, id);
+        len += sprintf(many + len, id % 5 ? "%zu\n" : "%zu\r\n", id);
+    }
+    for (size_t threads = 1; threads <= 9; threads++)
+        assert(count_fresh_ids_parallel(tree, many, many + len, threads) == expected);
+    // no trailing newline, and a tiny section that stays on one thread
+    assert(count_fresh_ids_parallel(tree, many, many + len - 1, 4) == expected);
+    const char* two = "1000\n5000";
+    assert(count_fresh_ids_parallel(tree, two, two + strlen(two), 4) == 2);
+    range_eytzinger_free(tree);
+    range_index_free(index);
+    range_array_free(arr);
+    free(many);
+
+    // no id section
+    arr = parse_ranges("1-2\n", 4, &ids);
+    assert(arr->len == 1 && ids == 4);
+    range_array_free(arr);
+
+    // SIZE_MAX is the largest id, one more must not wrap around
+    size_t id;
+    const char* max = "18446744073709551615\n";
+    assert(parse_id(max, max + 21, &id) == max + 20 && id == SIZE_MAX);
+    const char* over = "18446744073709551616\n";
+    assert(parse_id(over, over + 21, &id) == over + 19);
+    const char* long_id = "100000000000000000000000-1\n";
+    assert(parse_id(long_id, long_id + 27, &id) == long_id + 20);
+    printf("test_parse passed.\n");
+}
+
+// Binary index file: the merged ranges written out so a restart maps them
+// instead of parsing and merging the input again. Little-endian, native
+// layout, every section starts on a 64-byte boundary:
+//
+//   header      magic "FRESHIDX", version, len
+//   ranges      range_t[len], sorted and merged
+//   cumulative  size_t[len], ids covered by ranges[0..i]
+//   starts      size_t[len + 1], Eytzinger order, see range_eytzinger_t
+//   ends        size_t[len + 1]
+//
+// Mapping checks the header and the file size and nothing else, so opening
+// costs the same for ten ranges or a hundred million.
+#define RANGE_FILE_MAGIC "FRESHIDX"
+#define RANGE_FILE_VERSION 1
+
+_Static_assert(sizeof(size_t) == 8 && sizeof(range_t) == 16, "range file assumes 64-bit ids");
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+    uint64_t len;
+    uint8_t pad[40];
+} range_file_header_t;
+
+_Static_assert(sizeof(range_file_header_t) == 64, "range file header is one cache line");
+
+typedef struct {
+    size_t ranges;
+    size_t cumulative;
+    size_t starts;
+    size_t ends;
+    size_t size;
+} range_file_layout_t;
+
+size_t range_file_align(size_t offset) {
+    return (offset + 63) & ~(size_t)63;
+}
+
+range_file_layout_t range_file_layout(size_t len) {
+    range_file_layout_t layout;
+    layout.ranges = sizeof(range_file_header_t);
+    layout.cumulative = range_file_align(layout.ranges + len * sizeof(range_t));
+    layout.starts = range_file_align(layout.cumulative + len * sizeof(size_t));
+    layout.ends = range_file_align(layout.starts + (len + 1) * sizeof(size_t));
+    layout.size = range_file_align(layout.ends + (len + 1) * sizeof(size_t));
+    return layout;
+}
+
+typedef struct {
+    void* map;
+    size_t size;
+    range_index_t index;        // these point into the mapping,
+    range_eytzinger_t tree;     // don't free them
+    const size_t* cumulative;
+} range_file_t;
+
+void range_file_write_at(FILE* file, size_t offset, const void* data, size_t bytes) {
+    static const char zeros[64] = { 0 };
+    long pos = ftell(file);
+    assert(pos >= 0 && (size_t)pos <= offset && offset - (size_t)pos < 64);
+    fwrite(zeros, 1, offset - (size_t)pos, file);
+    if (bytes > 0)
+        fwrite(data, 1, bytes, file);
+}
+
+void range_file_write(range_index_t* index, const char* filename) {
+    FILE* file = fopen(filename, "wb");
     if (file == NULL) {
-        printf("FAILED TO OPEN INPUT FILE.\n");
+        printf("FAILED TO OPEN INDEX FILE FOR WRITING.\n");
         exit(-1);
     }
 
-    char buf[256];
-    size_t line = 0;
-    bool check_freshness = false;
-    range_array_t* range_array = range_array_create(150);
-    size_t fresh = 0;
-    while(fgets(buf, sizeof(buf), file) != NULL) {
-        line += 1;
-        if (isspace(*buf)) {
-            check_freshness = true;
-        } else if (check_freshness) {
-            // check freshness of single id
-            assert(range_array->len == 182);
-            size_t id = string_to_id(buf, 0, strlen(buf) - 1);
-            for (int i = 0; i < range_array->len; i++) {
-                if (range_contains(range_array->ptr + i, id)) {
-                    fresh += 1;
-                    break;
+    range_file_layout_t layout = range_file_layout(index->len);
+    range_file_header_t header = { .version = RANGE_FILE_VERSION, .len = index->len };
+    memcpy(header.magic, RANGE_FILE_MAGIC, sizeof(header.magic));
+
+    size_t* cumulative = (size_t*)malloc(sizeof(size_t) * (index->len + 1));
+    size_t accum = 0;
+    for (size_t i = 0; i < index->len; i++) {
+        accum += range_count(&index->ranges[i]);
+        cumulative[i] = accum;
+    }
+    range_eytzinger_t* tree = range_eytzinger_create(index);
+
+    fwrite(&header, sizeof(header), 1, file);
+    range_file_write_at(file, layout.ranges, index->ranges, index->len * sizeof(range_t));
+    range_file_write_at(file, layout.cumulative, cumulative, index->len * sizeof(size_t));
+    range_file_write_at(file, layout.starts, tree->starts, (index->len + 1) * sizeof(size_t));
+    range_file_write_at(file, layout.ends, tree->ends, (index->len + 1) * sizeof(size_t));
+    range_file_write_at(file, layout.size, NULL, 0);
+    if (ferror(file) || fclose(file) != 0) {
+        printf("FAILED TO WRITE INDEX FILE.\n");
+        exit(-1);
+    }
+
+    range_eytzinger_free(tree);
+    free(cumulative);
+}
+
+range_file_t* range_file_map(const char* filename) {
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        printf("FAILED TO OPEN INDEX FILE.\n");
+        exit(-1);
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(range_file_header_t)) {
+        printf("INDEX FILE IS TOO SHORT.\n");
+        exit(-1);
+    }
+
+    range_file_t* file = (range_file_t*)malloc(sizeof(range_file_t));
+    file->size = (size_t)st.st_size;
+    file->map = mmap(NULL, file->size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (file->map == MAP_FAILED) {
+        printf("FAILED TO MAP INDEX FILE.\n");
+        exit(-1);
+    }
+
+    const range_file_header_t* header = (const range_file_header_t*)file->map;
+    if (memcmp(header->magic, RANGE_FILE_MAGIC, sizeof(header->magic)) != 0
+            || header->version != RANGE_FILE_VERSION) {
+        printf("NOT A VERSION %d INDEX FILE.\n", RANGE_FILE_VERSION);
+        exit(-1);
+    }
+    // checked before the layout so a bogus len can't overflow it
+    if (header->len > file->size / sizeof(range_t)
+            || range_file_layout(header->len).size != file->size) {
+        printf("INDEX FILE SIZE DOESN'T MATCH ITS HEADER.\n");
+        exit(-1);
+    }
+
+    range_file_layout_t layout = range_file_layout(header->len);
+    const char* base = (const char*)file->map;
+    file->index.ranges = (range_t*)(base + layout.ranges);
+    file->index.len = header->len;
+    file->cumulative = (const size_t*)(base + layout.cumulative);
+    file->tree.starts = (size_t*)(base + layout.starts);
+    file->tree.ends = (size_t*)(base + layout.ends);
+    file->tree.len = header->len;
+    return file;
+}
+
+void range_file_close(range_file_t* file) {
+    munmap(file->map, file->size);
+    free(file);
+}
+
+size_t range_file_count_ids(range_file_t* file) {
+    return file->index.len ? file->cumulative[file->index.len - 1] : 0;
+}
+
+// Fresh ids <= id.
+size_t range_file_count_upto(range_file_t* file, size_t id) {
+    range_t* ranges = file->index.ranges;
+    size_t lo = 0;
+    size_t hi = file->index.len;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (ranges[mid].start <= id)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if (lo == 0)
+        return 0;
+    range_t* last = &ranges[lo - 1];
+    size_t before = lo > 1 ? file->cumulative[lo - 2] : 0;
+    return before + (id < last->end ? id : last->end) - last->start + 1;
+}
+
+// Where the ids start when the ranges come from an index file: after the
+// first blank line, or at the first line that isn't a range, so both the
+// puzzle input and a bare list of ids work.
+size_t find_id_section(const char* data, size_t size) {
+    const char* p = data;
+    const char* end = data + size;
+    while (p < end) {
+        const char* blank = skip_newline(p, end);
+        if (blank != NULL)
+            return (size_t)(blank - data);
+        const char* newline = memchr(p, '\n', end - p);
+        const char* line_end = newline ? newline : end;
+        if (memchr(p, '-', line_end - p) == NULL)
+            break;
+        p = newline ? newline + 1 : end;
+    }
+    return (size_t)(p - data);
+}
+
+void test_range_file() {
+    // a path of our own, processes starting together must not share one
+    char path[] = "/tmp/fresh_test_index_XXXXXX";
+    int fd = mkstemp(path);
+    assert(fd >= 0);
+    close(fd);
+    range_array_t* arr = range_array_create(8);
+    uint64_t seed = 0xf11e;
+    for (size_t i = 0; i < 300; i++) {
+        size_t start = next_random(&seed) % 100000;
+        range_array_add_range(arr, start, start + next_random(&seed) % 300);
+    }
+    range_array_add_range(arr, SIZE_MAX - 5, SIZE_MAX - 1);
+    range_index_t* index = range_index_create(arr);
+    range_eytzinger_t* tree = range_eytzinger_create(index);
+    range_file_write(index, path);
+
+    range_file_t* file = range_file_map(path);
+    assert(file->index.len == index->len);
+    assert(memcmp(file->index.ranges, index->ranges, sizeof(range_t) * index->len) == 0);
+    assert(memcmp(file->tree.starts + 1, tree->starts + 1, sizeof(size_t) * index->len) == 0);
+    assert(range_file_count_ids(file) == range_index_count_ids(index));
+    size_t upto = 0;
+    for (size_t id = 0; id < 100500; id++) {
+        bool fresh = range_index_contains(index, id);
+        upto += fresh;
+        assert(range_eytzinger_contains(&file->tree, id) == fresh);
+        assert(range_file_count_upto(file, id) == upto);
+    }
+    assert(range_file_count_upto(file, SIZE_MAX) == range_index_count_ids(index));
+    range_file_close(file);
+
+    arr->len = 0;
+    range_index_free(index);
+    index = range_index_create(arr);
+    range_file_write(index, path);
+    file = range_file_map(path);
+    assert(file->index.len == 0 && range_file_count_ids(file) == 0);
+    assert(!range_eytzinger_contains(&file->tree, 3) && range_file_count_upto(file, 3) == 0);
+    range_file_close(file);
+
+    const char* text = "3-5\n10-14\n\n1\n5\n";
+    assert(find_id_section(text, strlen(text)) == 11);
+    assert(find_id_section("1\n5\n", 4) == 0);
+
+    remove(path);
+    range_eytzinger_free(tree);
+    range_index_free(index);
+    range_array_free(arr);
+    printf("test_range_file passed.\n");
+}
+
+// Snapshots for updating the ranges while queries run. A snapshot is an
+// immutable merged array with its Eytzinger tree. A writer builds the next
+// one from the current one in a linear pass, swaps the shared pointer and
+// retires the old one, readers never lock.
+//
+// Reclaiming uses epochs: every reader owns a slot and, while it holds a
+// snapshot, publishes the global epoch it saw on entering. A snapshot is
+// retired at the epoch its replacement was published in and freed once no
+// slot holds that epoch or an older one, any reader that could still see
+// it entered no later than that.
+typedef struct range_snapshot range_snapshot_t;
+typedef struct range_snapshot {
+    range_index_t index;
+    range_eytzinger_t* tree;
+    size_t count;
+    uint64_t retired_at;
+    range_snapshot_t* next_retired;
+} range_snapshot_t;
+
+#define RCU_QUIESCENT UINT64_MAX
+
+typedef struct {
+    _Atomic uint64_t epoch;     // RCU_QUIESCENT while not reading
+} __attribute__((aligned(64))) rcu_slot_t;
+
+typedef struct {
+    _Atomic(range_snapshot_t*) current;
+    _Atomic uint64_t epoch;
+    rcu_slot_t* slots;
+    size_t num_slots;
+    pthread_mutex_t writer;     // one writer at a time, guards retired
+    range_snapshot_t* retired;
+    size_t num_retired;
+} range_rcu_t;
+
+// Takes ownership of ranges, which must be sorted and merged.
+range_snapshot_t* range_snapshot_create(range_t* ranges, size_t len) {
+    range_snapshot_t* snap = (range_snapshot_t*)malloc(sizeof(range_snapshot_t));
+    snap->index.ranges = ranges;
+    snap->index.len = len;
+    snap->tree = range_eytzinger_create(&snap->index);
+    snap->count = range_index_count_ids(&snap->index);
+    snap->retired_at = 0;
+    snap->next_retired = NULL;
+    return snap;
+}
+
+void range_snapshot_free(range_snapshot_t* snap) {
+    range_eytzinger_free(snap->tree);
+    free(snap->index.ranges);
+    free(snap);
+}
+
+range_snapshot_t* range_snapshot_with(range_snapshot_t* old, range_t range) {
+    size_t len = old->index.len;
+    range_t* ranges = (range_t*)malloc(sizeof(range_t) * (len + 1));
+    size_t pos = 0;
+    while (pos < len && old->index.ranges[pos].start <= range.start)
+        pos++;
+    memcpy(ranges, old->index.ranges, sizeof(range_t) * pos);
+    ranges[pos] = range;
+    memcpy(ranges + pos + 1, old->index.ranges + pos, sizeof(range_t) * (len - pos));
+    return range_snapshot_create(ranges, range_merge_sorted(ranges, len + 1));
+}
+
+range_snapshot_t* range_snapshot_without(range_snapshot_t* old, range_t range) {
+    // at most one range is cut in two
+    range_t* ranges = (range_t*)malloc(sizeof(range_t) * (old->index.len + 1));
+    size_t len = 0;
+    for (size_t i = 0; i < old->index.len; i++) {
+        range_t r = old->index.ranges[i];
+        if (!range_overlap(&r, &range)) {
+            ranges[len++] = r;
+            continue;
+        }
+        if (r.start < range.start)
+            ranges[len++] = (range_t){ .start = r.start, .end = range.start - 1 };
+        if (r.end > range.end)
+            ranges[len++] = (range_t){ .start = range.end + 1, .end = r.end };
+    }
+    return range_snapshot_create(ranges, len);
+}
+
+range_rcu_t* range_rcu_create(range_index_t* index, size_t num_slots) {
+    range_rcu_t* rcu = (range_rcu_t*)malloc(sizeof(range_rcu_t));
+    range_t* ranges = (range_t*)malloc(sizeof(range_t) * (index->len ? index->len : 1));
+    memcpy(ranges, index->ranges, sizeof(range_t) * index->len);
+    atomic_init(&rcu->current, range_snapshot_create(ranges, index->len));
+    atomic_init(&rcu->epoch, 0);
+    rcu->slots = (rcu_slot_t*)aligned_alloc(64, sizeof(rcu_slot_t) * num_slots);
+    for (size_t i = 0; i < num_slots; i++)
+        atomic_init(&rcu->slots[i].epoch, RCU_QUIESCENT);
+    rcu->num_slots = num_slots;
+    pthread_mutex_init(&rcu->writer, NULL);
+    rcu->retired = NULL;
+    rcu->num_retired = 0;
+    return rcu;
+}
+
+// No reader may be inside.
+void range_rcu_free(range_rcu_t* rcu) {
+    while (rcu->retired != NULL) {
+        range_snapshot_t* next = rcu->retired->next_retired;
+        range_snapshot_free(rcu->retired);
+        rcu->retired = next;
+    }
+    range_snapshot_free(atomic_load(&rcu->current));
+    pthread_mutex_destroy(&rcu->writer);
+    free(rcu->slots);
+    free(rcu);
+}
+
+// The snapshot stays valid until range_rcu_exit on the same slot.
+range_snapshot_t* range_rcu_enter(range_rcu_t* rcu, rcu_slot_t* slot) {
+    atomic_store(&slot->epoch, atomic_load(&rcu->epoch));
+    return atomic_load(&rcu->current);
+}
+
+void range_rcu_exit(rcu_slot_t* slot) {
+    atomic_store_explicit(&slot->epoch, RCU_QUIESCENT, memory_order_release);
+}
+
+// Frees what no reader can still hold. Writer lock held.
+void range_rcu_reclaim(range_rcu_t* rcu) {
+    uint64_t oldest = RCU_QUIESCENT;
+    for (size_t i = 0; i < rcu->num_slots; i++) {
+        uint64_t epoch = atomic_load(&rcu->slots[i].epoch);
+        if (epoch < oldest)
+            oldest = epoch;
+    }
+    range_snapshot_t** link = &rcu->retired;
+    while (*link != NULL) {
+        range_snapshot_t* snap = *link;
+        if (snap->retired_at < oldest) {
+            *link = snap->next_retired;
+            range_snapshot_free(snap);
+            rcu->num_retired--;
+        } else {
+            link = &snap->next_retired;
+        }
+    }
+}
+
+// Adds or removes an id range. len and count, when not NULL, get the
+// size of the published snapshot.
+void range_rcu_update(range_rcu_t* rcu, range_t range, bool add, size_t* len, size_t* count) {
+    pthread_mutex_lock(&rcu->writer);
+    range_snapshot_t* old = atomic_load(&rcu->current);
+    range_snapshot_t* new = add ? range_snapshot_with(old, range) : range_snapshot_without(old, range);
+    atomic_store(&rcu->current, new);
+    old->retired_at = atomic_fetch_add(&rcu->epoch, 1);
+    old->next_retired = rcu->retired;
+    rcu->retired = old;
+    rcu->num_retired++;
+    range_rcu_reclaim(rcu);
+    if (len != NULL)
+        *len = new->index.len;
+    if (count != NULL)
+        *count = new->count;
+    pthread_mutex_unlock(&rcu->writer);
+}
+
+typedef struct {
+    range_rcu_t* rcu;
+    rcu_slot_t* slot;
+    atomic_bool* done;
+    uint64_t seed;
+    size_t snapshots;
+} rcu_test_reader_t;
+
+void* rcu_test_reader(void* arg) {
+    rcu_test_reader_t* reader = (rcu_test_reader_t*)arg;
+    while (!atomic_load(reader->done)) {
+        range_snapshot_t* snap = range_rcu_enter(reader->rcu, reader->slot);
+        // a torn or freed snapshot disagrees with itself
+        size_t count = 0;
+        for (size_t i = 0; i < snap->index.len; i++)
+            count += range_count(&snap->index.ranges[i]);
+        assert(count == snap->count);
+        for (int i = 0; i < 32; i++) {
+            size_t id = next_random(&reader->seed) % 3000;
+            assert(range_eytzinger_contains(snap->tree, id) == range_index_contains(&snap->index, id));
+        }
+        range_rcu_exit(reader->slot);
+        reader->snapshots++;
+    }
+    return NULL;
+}
+
+void test_range_rcu() {
+    range_array_t* arr = range_array_create(4);
+    range_array_add_range(arr, 3, 5);
+    range_array_add_range(arr, 10, 20);
+    range_index_t* index = range_index_create(arr);
+    range_rcu_t* rcu = range_rcu_create(index, 3);
+    rcu_slot_t* slot = &rcu->slots[0];
+
+    size_t len, count;
+    range_rcu_update(rcu, (range_t){ .start = 6, .end = 9 }, true, &len, &count);
+    assert(len == 1 && count == 18);
+    range_rcu_update(rcu, (range_t){ .start = 8, .end = 8 }, false, &len, &count);
+    assert(len == 2 && count == 17);
+    assert(rcu->num_retired == 0);
+
+    // a held snapshot survives later updates and is freed after exit
+    range_snapshot_t* held = range_rcu_enter(rcu, slot);
+    range_rcu_update(rcu, (range_t){ .start = 0, .end = 100 }, false, NULL, NULL);
+    range_rcu_update(rcu, (range_t){ .start = 50, .end = 60 }, true, NULL, NULL);
+    assert(rcu->num_retired == 2);
+    assert(held->count == 17 && range_eytzinger_contains(held->tree, 7));
+    range_rcu_exit(slot);
+    range_rcu_update(rcu, (range_t){ .start = 61, .end = 61 }, true, &len, &count);
+    assert(rcu->num_retired == 0 && len == 1 && count == 12);
+
+    // random updates against the interval set
+    range_set_t* set = range_set_create();
+    range_set_insert(set, (range_t){ .start = 50, .end = 61 });
+    uint64_t seed = 0x7c0;
+    for (int op = 0; op < 600; op++) {
+        size_t start = next_random(&seed) % 2000;
+        range_t range = { .start = start, .end = start + next_random(&seed) % 60 };
+        bool add = next_random(&seed) % 3 != 0;
+        range_rcu_update(rcu, range, add, &len, &count);
+        if (add)
+            range_set_insert(set, range);
+        else
+            range_set_remove(set, range);
+        assert(len == set->len && count == range_set_count_ids(set));
+        if (op % 100 == 0) {
+            range_snapshot_t* snap = range_rcu_enter(rcu, slot);
+            for (size_t id = 0; id < 2100; id++)
+                assert(range_eytzinger_contains(snap->tree, id) == range_set_contains(set, id));
+            range_rcu_exit(slot);
+        }
+    }
+    range_set_free(set);
+
+    // readers check every snapshot they get while a writer churns
+    atomic_bool done;
+    atomic_init(&done, false);
+    pthread_t threads[2];
+    rcu_test_reader_t readers[2];
+    for (int i = 0; i < 2; i++) {
+        readers[i] = (rcu_test_reader_t){ .rcu = rcu, .slot = &rcu->slots[i + 1], .done = &done, .seed = 11 + i };
+        pthread_create(&threads[i], NULL, rcu_test_reader, &readers[i]);
+    }
+    for (int op = 0; op < 2000; op++) {
+        size_t start = next_random(&seed) % 2000;
+        range_rcu_update(rcu, (range_t){ .start = start, .end = start + next_random(&seed) % 60 },
+                next_random(&seed) % 3 != 0, NULL, NULL);
+    }
+    atomic_store(&done, true);
+    for (int i = 0; i < 2; i++)
+        pthread_join(threads[i], NULL);
+    range_rcu_update(rcu, (range_t){ .start = 0, .end = 0 }, true, NULL, NULL);
+    assert(rcu->num_retired == 0);
+
+    range_rcu_free(rcu);
+    range_index_free(index);
+    range_array_free(arr);
+    printf("test_range_rcu passed.\n");
+}
+
+// Query service: the ranges are indexed once, then ids are answered over
+// stdin/stdout or a unix socket until the client hangs up.
+//
+// Text protocol: each line holds one or more ids separated by spaces, the
+// reply is a line with a 0 or 1 per id. "add A-B" and "remove A-B" update
+// the ranges for every connection and reply "ok ranges=N ids=M". "stats"
+// replies with the counters below, a bad line replies "error: bad id".
+//
+// Binary protocol (--binary): a request is a uint32 id count followed by
+// that many uint64 ids, the reply is a bitmap of (count + 7) / 8 bytes,
+// bit i (LSB first) set when id i is fresh. Both are native-endian.
+//
+// Latency is measured from the read that completes a request to the write
+// that carries its reply, so it includes the socket but not the client.
+//
+// Lookups go through range_rcu_t: a connection enters once per read and
+// answers everything in it from that snapshot, updates don't wait for it.
+#define SERVICE_BUFFER (1 << 16)
+#define SERVICE_MAX_CONNECTIONS 64
+#define SERVICE_MAX_BATCH (1 << 24)
+#define SERVICE_BUCKETS 40
+
+typedef struct {
+    size_t requests;
+    size_t ids;
+    size_t fresh;
+    double busy;            // seconds spent answering, for throughput
+    double latency_sum;     // per request, a read's requests share its time
+    double max_latency;
+    size_t latency[SERVICE_BUCKETS];    // bucket b: under 2^b microseconds
+} service_stats_t;
+
+void service_stats_record(service_stats_t* stats, size_t requests, size_t ids, size_t fresh, double seconds) {
+    stats->requests += requests;
+    stats->ids += ids;
+    stats->fresh += fresh;
+    stats->busy += seconds;
+    stats->latency_sum += seconds * requests;
+    if (seconds > stats->max_latency)
+        stats->max_latency = seconds;
+    size_t micros = (size_t)(seconds * 1e6);
+    int bucket = 0;
+    while (bucket < SERVICE_BUCKETS - 1 && micros >= ((size_t)1 << bucket))
+        bucket++;
+    stats->latency[bucket] += requests;
+}
+
+// Upper bound of the bucket holding the given fraction of requests.
+size_t service_stats_percentile(service_stats_t* stats, double fraction) {
+    if (stats->requests == 0)
+        return 0;
+    size_t target = (size_t)(stats->requests * fraction);
+    size_t seen = 0;
+    for (int b = 0; b < SERVICE_BUCKETS; b++) {
+        seen += stats->latency[b];
+        if (seen > target)
+            return (size_t)1 << b;
+    }
+    return (size_t)1 << (SERVICE_BUCKETS - 1);
+}
+
+void service_stats_merge(service_stats_t* dst, service_stats_t* src) {
+    dst->requests += src->requests;
+    dst->ids += src->ids;
+    dst->fresh += src->fresh;
+    dst->busy += src->busy;
+    dst->latency_sum += src->latency_sum;
+    if (src->max_latency > dst->max_latency)
+        dst->max_latency = src->max_latency;
+    for (int b = 0; b < SERVICE_BUCKETS; b++)
+        dst->latency[b] += src->latency[b];
+}
+
+int service_stats_format(service_stats_t* stats, char* buf, size_t cap) {
+    double mean = stats->requests ? stats->latency_sum / stats->requests : 0;
+    double rate = stats->busy > 0 ? stats->ids / stats->busy : 0;
+    return snprintf(buf, cap, "requests=%zu ids=%zu fresh=%zu mean_us=%.2f p50_us<%zu p99_us<%zu max_us=%.2f ids_per_sec=%.0f\n",
+            stats->requests, stats->ids, stats->fresh, mean * 1e6,
+            service_stats_percentile(stats, 0.5), service_stats_percentile(stats, 0.99),
+            stats->max_latency * 1e6, rate);
+}
+
+bool write_all(int fd, const void* data, size_t len) {
+    const char* p = (const char*)data;
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        p += n;
+        len -= (size_t)n;
+    }
+    return true;
+}
+
+// false on end of input or an error before len bytes arrived
+bool read_full(int fd, void* data, size_t len) {
+    char* p = (char*)data;
+    while (len > 0) {
+        ssize_t n = read(fd, p, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        p += n;
+        len -= (size_t)n;
+    }
+    return true;
+}
+
+// "add A-B" or "remove A-B", false if the line is neither.
+bool serve_update_line(range_rcu_t* rcu, const char* p, const char* end, char* out, size_t* reply_len) {
+    bool add = (size_t)(end - p) > 4 && memcmp(p, "add ", 4) == 0;
+    bool remove = (size_t)(end - p) > 7 && memcmp(p, "remove ", 7) == 0;
+    if (!add && !remove)
+        return false;
+
+    range_t range;
+    const char* first = p + (add ? 4 : 7);
+    const char* dash = parse_id(first, end, &range.start);
+    const char* after = dash < end && *dash == '-' ? parse_id(dash + 1, end, &range.end) : NULL;
+    if (dash == first || after == NULL || after != end || after == dash + 1 || range.start > range.end) {
+        memcpy(out, "error: bad range\n", 17);
+        *reply_len = 17;
+        return true;
+    }
+    size_t len, count;
+    range_rcu_update(rcu, range, add, &len, &count);
+    *reply_len = (size_t)snprintf(out, 64, "ok ranges=%zu ids=%zu\n", len, count);
+    return true;
+}
+
+// Appends the reply for one text line to out, returns its length. Every
+// line but "stats" counts as a request, *updated is set after an update.
+size_t serve_text_line(range_rcu_t* rcu, range_snapshot_t* snap, const char* p, const char* end,
+        char* out, service_stats_t* stats, size_t* requests, size_t* ids, size_t* fresh, bool* updated) {
+    if (end > p && end[-1] == '\r')
+        end--;
+    if ((size_t)(end - p) == 5 && memcmp(p, "stats", 5) == 0)
+        return (size_t)service_stats_format(stats, out, SERVICE_BUFFER);
+
+    *requests += 1;
+    size_t reply_len;
+    if (serve_update_line(rcu, p, end, out, &reply_len)) {
+        *updated = true;
+        return reply_len;
+    }
+
+    size_t len = 0;
+    size_t line_fresh = 0;
+    while (p < end) {
+        if (*p == ' ') {
+            p++;
+            continue;
+        }
+        size_t id;
+        const char* after = parse_id(p, end, &id);
+        if (after == p || (after < end && *after != ' ')) {
+            memcpy(out, "error: bad id\n", 14);
+            return 14;
+        }
+        bool is_fresh = range_eytzinger_contains(snap->tree, id);
+        out[len++] = is_fresh ? '1' : '0';
+        line_fresh += is_fresh;
+        p = after;
+    }
+    out[len++] = '\n';
+    *ids += len - 1;
+    *fresh += line_fresh;
+    return len;
+}
+
+void serve_text(range_rcu_t* rcu, rcu_slot_t* slot, int in, int out, service_stats_t* stats) {
+    char* buf = (char*)malloc(SERVICE_BUFFER);
+    // replies are flushed past 2 buffers, one more line's reply (at most
+    // a buffer, or the stats) always fits after that
+    char* reply = (char*)malloc(3 * SERVICE_BUFFER + 256);
+    size_t len = 0;
+    bool skipping = false;      // inside a line too long for the buffer
+    bool open = true;
+    for (;;) {
+        ssize_t n = read(in, buf + len, SERVICE_BUFFER - len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        double start = seconds_now();
+        len += (size_t)n;
+
+        range_snapshot_t* snap = range_rcu_enter(rcu, slot);
+        size_t reply_len = 0;
+        size_t requests = 0, ids = 0, fresh = 0;
+        char* p = buf;
+        char* end = buf + len;
+        char* newline;
+        while (open && (newline = memchr(p, '\n', end - p)) != NULL) {
+            if (skipping) {
+                skipping = false;
+            } else {
+                bool updated = false;
+                reply_len += serve_text_line(rcu, snap, p, newline, reply + reply_len,
+                        stats, &requests, &ids, &fresh, &updated);
+                if (updated) {
+                    // later lines see the update
+                    range_rcu_exit(slot);
+                    snap = range_rcu_enter(rcu, slot);
                 }
             }
-        } else { // parse id range
-            int split_idx = find_char(buf, '-');
-            assert(split_idx != -1);
-            size_t start = string_to_id(buf, 0, split_idx);
-            size_t end = string_to_id(buf, split_idx + 1, strlen(buf) - 1);
-            range_array_add_range(range_array, start, end);
+            p = newline + 1;
+            if (reply_len > 2 * SERVICE_BUFFER) {
+                // a slow client can block the write, it must not keep
+                // retired snapshots from being freed meanwhile
+                range_rcu_exit(slot);
+                open = write_all(out, reply, reply_len);
+                reply_len = 0;
+                snap = range_rcu_enter(rcu, slot);
+            }
         }
+        range_rcu_exit(slot);
+        if (!open)
+            break;
+
+        len = (size_t)(end - p);
+        memmove(buf, p, len);
+        if (len == SERVICE_BUFFER) {
+            len = 0;
+            if (!skipping) {
+                memcpy(reply + reply_len, "error: line too long\n", 21);
+                reply_len += 21;
+            }
+            skipping = true;
+        }
+
+        if (reply_len > 0 && !write_all(out, reply, reply_len)) {
+            open = false;
+            break;
+        }
+        if (requests > 0)
+            service_stats_record(stats, requests, ids, fresh, seconds_now() - start);
+    }
+    // the last line may have no newline
+    if (open && len > 0 && !skipping) {
+        double start = seconds_now();
+        size_t requests = 0, ids = 0, fresh = 0;
+        bool updated = false;
+        range_snapshot_t* snap = range_rcu_enter(rcu, slot);
+        size_t reply_len = serve_text_line(rcu, snap, buf, buf + len, reply, stats,
+                &requests, &ids, &fresh, &updated);
+        range_rcu_exit(slot);
+        write_all(out, reply, reply_len);
+        if (requests > 0)
+            service_stats_record(stats, requests, ids, fresh, seconds_now() - start);
     }
+    free(reply);
+    free(buf);
+}
 
-    printf("Part 1: %zu\n", fresh);
-    fclose(file);
+void serve_binary(range_rcu_t* rcu, rcu_slot_t* slot, int in, int out, service_stats_t* stats) {
+    size_t cap = 1024;
+    uint64_t* ids = (uint64_t*)malloc(sizeof(uint64_t) * cap);
+    uint8_t* bitmap = (uint8_t*)malloc(cap / 8);
+    uint32_t count;
+    while (read_full(in, &count, sizeof(count))) {
+        if (count > SERVICE_MAX_BATCH) {
+            fprintf(stderr, "BATCH OF %u IDS IS TOO LARGE, CLOSING.\n", count);
+            break;
+        }
+        if (count > cap) {
+            while (cap < count)
+                cap *= 2;
+            ids = (uint64_t*)realloc(ids, sizeof(uint64_t) * cap);
+            bitmap = (uint8_t*)realloc(bitmap, cap / 8);
+        }
+        if (!read_full(in, ids, sizeof(uint64_t) * count))
+            break;
 
-    file = fopen(input_name, "r");
+        double start = seconds_now();
+        size_t bytes = (count + 7) / 8;
+        memset(bitmap, 0, bytes);
+        size_t fresh = 0;
+        range_snapshot_t* snap = range_rcu_enter(rcu, slot);
+        for (size_t i = 0; i < count; i++) {
+            bool is_fresh = range_eytzinger_contains(snap->tree, ids[i]);
+            bitmap[i / 8] |= (uint8_t)(is_fresh << (i % 8));
+            fresh += is_fresh;
+        }
+        range_rcu_exit(slot);
+        if (!write_all(out, bitmap, bytes))
+            break;
+        service_stats_record(stats, 1, count, fresh, seconds_now() - start);
+    }
+    free(bitmap);
+    free(ids);
+}
+
+void serve_fd(range_rcu_t* rcu, rcu_slot_t* slot, int in, int out, bool binary, service_stats_t* stats) {
+    if (binary)
+        serve_binary(rcu, slot, in, out, stats);
+    else
+        serve_text(rcu, slot, in, out, stats);
+}
+
+typedef struct {
+    range_rcu_t* rcu;
+    bool binary;
+    pthread_mutex_t lock;   // guards stats and slot_busy
+    service_stats_t stats;
+    bool slot_busy[SERVICE_MAX_CONNECTIONS];
+} service_t;
+
+typedef struct {
+    service_t* service;
+    size_t slot;
+    int fd;
+} service_conn_t;
+
+void* service_conn_worker(void* arg) {
+    service_conn_t* conn = (service_conn_t*)arg;
+    service_t* service = conn->service;
+    service_stats_t stats = { 0 };
+    serve_fd(service->rcu, &service->rcu->slots[conn->slot], conn->fd, conn->fd, service->binary, &stats);
+    close(conn->fd);
+
+    char line[256];
+    pthread_mutex_lock(&service->lock);
+    service_stats_merge(&service->stats, &stats);
+    service->slot_busy[conn->slot] = false;
+    service_stats_format(&service->stats, line, sizeof(line));
+    pthread_mutex_unlock(&service->lock);
+    fputs(line, stderr);
+    free(conn);
+    return NULL;
+}
+
+// Serves up to SERVICE_MAX_CONNECTIONS connections at once, a thread and
+// a reader slot each, until killed. "stats" shows a connection's own
+// counters, the totals go to stderr as each one closes.
+void serve_socket(range_rcu_t* rcu, const char* path, bool binary) {
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        printf("SOCKET PATH IS TOO LONG.\n");
+        exit(-1);
+    }
+    strcpy(addr.sun_path, path);
+    assert(rcu->num_slots >= SERVICE_MAX_CONNECTIONS);
+
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    unlink(path);
+    if (listener < 0 || bind(listener, (struct sockaddr*)&addr, sizeof(addr)) != 0
+            || listen(listener, 16) != 0) {
+        printf("FAILED TO LISTEN ON %s.\n", path);
+        exit(-1);
+    }
+    fprintf(stderr, "serving %zu ranges on %s\n", atomic_load(&rcu->current)->index.len, path);
+
+    service_t service = { .rcu = rcu, .binary = binary };
+    pthread_mutex_init(&service.lock, NULL);
+    for (;;) {
+        int fd = accept(listener, NULL, NULL);
+        if (fd < 0) {
+            if (errno == EINTR)
+                continue;
+            printf("FAILED TO ACCEPT A CONNECTION.\n");
+            exit(-1);
+        }
+
+        size_t slot = SERVICE_MAX_CONNECTIONS;
+        pthread_mutex_lock(&service.lock);
+        for (size_t i = 0; i < SERVICE_MAX_CONNECTIONS && slot == SERVICE_MAX_CONNECTIONS; i++) {
+            if (!service.slot_busy[i]) {
+                service.slot_busy[i] = true;
+                slot = i;
+            }
+        }
+        pthread_mutex_unlock(&service.lock);
+        if (slot == SERVICE_MAX_CONNECTIONS) {
+            fprintf(stderr, "TOO MANY CONNECTIONS, CLOSING ONE.\n");
+            close(fd);
+            continue;
+        }
+
+        service_conn_t* conn = (service_conn_t*)malloc(sizeof(service_conn_t));
+        *conn = (service_conn_t){ .service = &service, .slot = slot, .fd = fd };
+        pthread_t thread;
+        pthread_create(&thread, NULL, service_conn_worker, conn);
+        pthread_detach(thread);
+    }
+}
+
+void test_service() {
+    range_array_t* arr = range_array_create(4);
+    range_array_add_range(arr, 3, 5);
+    range_array_add_range(arr, 10, 20);
+    range_index_t* index = range_index_create(arr);
+    range_rcu_t* rcu = range_rcu_create(index, 1);
+
+    FILE* in = tmpfile();
+    FILE* out = tmpfile();
+    assert(in != NULL && out != NULL);
+    fputs("1 3 5 6\n20\r\n\nx\nstats\n21 10", in);
+    fflush(in);
+    rewind(in);
+    service_stats_t stats = { 0 };
+    serve_fd(rcu, &rcu->slots[0], fileno(in), fileno(out), false, &stats);
+    assert(stats.requests == 5 && stats.ids == 7 && stats.fresh == 4);
+
+    char reply[512] = { 0 };
+    rewind(out);
+    size_t len = fread(reply, 1, sizeof(reply) - 1, out);
+    const char* expected = "0110\n1\n\nerror: bad id\nrequests=";
+    assert(len > strlen(expected) && strncmp(reply, expected, strlen(expected)) == 0);
+    assert(strcmp(reply + len - 3, "01\n") == 0);
+    fclose(in);
+    fclose(out);
+
+    in = tmpfile();
+    out = tmpfile();
+    uint32_t count = 10;
+    uint64_t ids[10] = { 0, 3, 4, 5, 6, 9, 10, 15, 20, UINT64_MAX };
+    fwrite(&count, sizeof(count), 1, in);
+    fwrite(ids, sizeof(ids[0]), count, in);
+    count = 0;
+    fwrite(&count, sizeof(count), 1, in);
+    fflush(in);
+    rewind(in);
+    memset(&stats, 0, sizeof(stats));
+    serve_fd(rcu, &rcu->slots[0], fileno(in), fileno(out), true, &stats);
+    assert(stats.requests == 2 && stats.ids == 10 && stats.fresh == 6);
+    uint8_t bitmap[4] = { 0 };
+    rewind(out);
+    assert(fread(bitmap, 1, sizeof(bitmap), out) == 2);
+    assert(bitmap[0] == 0xce && bitmap[1] == 0x01);
+    fclose(in);
+    fclose(out);
+
+    // updates apply to the lines after them
+    in = tmpfile();
+    out = tmpfile();
+    fputs("7\nadd 6-9\n7 8\nremove 4-4\n4 5\nadd 9-8\nadd 1-18446744073709551625\n5 100000000000000000005\n"
+            "add -5\nremove -100000000000000\n0\n", in);
+    fflush(in);
+    rewind(in);
+    memset(&stats, 0, sizeof(stats));
+    serve_fd(rcu, &rcu->slots[0], fileno(in), fileno(out), false, &stats);
+    memset(reply, 0, sizeof(reply));
+    rewind(out);
+    len = fread(reply, 1, sizeof(reply) - 1, out);
+    assert(strcmp(reply, "0\nok ranges=1 ids=18\n11\nok ranges=2 ids=17\n01\nerror: bad range\n"
+            "error: bad range\nerror: bad id\nerror: bad range\nerror: bad range\n0\n") == 0);
+    fclose(in);
+    fclose(out);
+
+    range_rcu_free(rcu);
+    range_index_free(index);
+    range_array_free(arr);
+    printf("test_service passed.\n");
+}
+
+// Merged ranges of another database, from a text input or an index file.
+range_index_t* load_ranges(const char* filename) {
+    mapped_input_t* input = mapped_input_open(filename);
+    range_index_t* index;
+    if (input->size >= 8 && memcmp(input->data, RANGE_FILE_MAGIC, 8) == 0) {
+        range_file_t* file = range_file_map(filename);
+        index = range_index_alloc(file->index.len);
+        memcpy(index->ranges, file->index.ranges, sizeof(range_t) * file->index.len);
+        index->len = file->index.len;
+        range_file_close(file);
+    } else {
+        size_t ids;
+        range_array_t* arr = parse_ranges(input->data, input->size, &ids);
+        index = range_index_create(arr);
+        range_array_free(arr);
+    }
+    mapped_input_close(input);
+    return index;
+}
+
+// --compare=F: how many ids are fresh in this input (A), in F (B), both,
+// only one of them and exactly one.
+void compare_ranges(range_index_t* a, const char* filename) {
+    range_index_t* b = load_ranges(filename);
+    range_index_t* both = range_index_intersection(a, b);
+    range_index_t* a_only = range_index_difference(a, b);
+    range_index_t* b_only = range_index_difference(b, a);
+    range_index_t* one = range_index_symmetric_difference(a, b);
+    printf("Fresh in A: %zu\n", range_index_count_ids(a));
+    printf("Fresh in B: %zu\n", range_index_count_ids(b));
+    printf("Fresh in both: %zu\n", range_index_count_ids(both));
+    printf("Fresh in A only: %zu\n", range_index_count_ids(a_only));
+    printf("Fresh in B only: %zu\n", range_index_count_ids(b_only));
+    printf("Fresh in exactly one: %zu\n", range_index_count_ids(one));
+    range_index_free(one);
+    range_index_free(b_only);
+    range_index_free(a_only);
+    range_index_free(both);
+    range_index_free(b);
+}
+
+#define BENCH_RANGES_FILE "/tmp/fresh_bench_ranges.txt"
+#define BENCH_SPACE ((size_t)1 << 50)
+
+// --bench-merge=N [--overlap=X]: writes N random ranges over [0, 2^50)
+// to BENCH_RANGES_FILE, sized so an id is covered by X ranges on average
+// (default 1), and times loading them and building the merged index on 1
+// to --threads threads, as CSV. The file is kept as a ready-made input.
+void bench_merge(size_t n, double overlap, size_t max_threads) {
+    uint64_t seed = 0xbe7c4;
+    double mean_span = overlap * (double)BENCH_SPACE / (double)(n ? n : 1);
+    size_t max_span = (size_t)(2 * mean_span) + 1;
+    FILE* file = fopen(BENCH_RANGES_FILE, "w");
     if (file == NULL) {
-        printf("FAILED TO OPEN INPUT FILE.\n");
+        printf("FAILED TO OPEN %s.\n", BENCH_RANGES_FILE);
         exit(-1);
     }
-    range_array_t* arr = range_array_create(150);
-    while(fgets(buf, sizeof(buf), file) != NULL) {
-        line += 1;
-        if (isspace(*buf)) {
+    for (size_t i = 0; i < n; i++) {
+        size_t start = next_random(&seed) % BENCH_SPACE;
+        fprintf(file, "%zu-%zu\n", start, start + next_random(&seed) % max_span);
+    }
+    fputs("\n", file);
+    fclose(file);
+    fprintf(stderr, "wrote %zu ranges to %s\n", n, BENCH_RANGES_FILE);
+
+    double t0 = seconds_now();
+    mapped_input_t* input = mapped_input_open(BENCH_RANGES_FILE);
+    size_t ids;
+    range_array_t* arr = parse_ranges(input->data, input->size, &ids);
+    double parse = seconds_now() - t0;
+
+    printf("ranges,overlap,threads,step,ms,mranges_per_sec,merged\n");
+    printf("%zu,%.2f,1,parse,%.1f,%.2f,\n", n, overlap, parse * 1e3, n / parse / 1e6);
+    range_index_t* expected = NULL;
+    for (size_t threads = 1; threads <= max_threads; threads = threads < max_threads && threads * 2 > max_threads ? max_threads : threads * 2) {
+        double start = seconds_now();
+        range_index_t* index = threads == 1 ? range_index_create(arr) : range_index_create_parallel(arr, threads);
+        double seconds = seconds_now() - start;
+        printf("%zu,%.2f,%zu,sort_merge,%.1f,%.2f,%zu\n", n, overlap, threads,
+                seconds * 1e3, n / seconds / 1e6, index->len);
+        fflush(stdout);
+        if (expected == NULL) {
+            expected = index;
+        } else {
+            assert(index->len == expected->len);
+            assert(memcmp(index->ranges, expected->ranges, sizeof(range_t) * index->len) == 0);
+            range_index_free(index);
+        }
+        if (threads == max_threads)
             break;
-        } else { // parse id range
-            int split_idx = find_char(buf, '-');
-            assert(split_idx != -1);
-            size_t start = string_to_id(buf, 0, split_idx);
-            size_t end = string_to_id(buf, split_idx + 1, strlen(buf) - 1);
-            range_array_add_range(arr, start, end);
+    }
+
+    range_index_free(expected);
+    range_array_free(arr);
+    mapped_input_close(input);
+}
+
+// fresh [--batch] [--threads=N] [--write-index=F] [--index=F] [--compare=F]
+//       [--serve[=PATH]] [--binary] [--bench-lookup[=E]]
+//       [--bench-merge=N [--overlap=X]] [input file]
+// Reads input.txt by default. The merged index is built on --threads
+// threads (all cores by default), see range_index_create_parallel, and
+// part 1 checks each id as it is parsed on as many, see
+// count_fresh_ids_parallel.
+// With --batch the ids are collected and checked in one merge-join instead.
+// --write-index saves the merged ranges as a binary index, --index maps
+// one and takes the ranges from it, see range_file_t. The input then only
+// needs the ids, a range section is skipped.
+// --compare prints how the fresh ids relate to the ranges in another text
+// input or index file, after the answers, see compare_ranges.
+// --serve answers queries on stdin/stdout, --serve=PATH on a unix socket,
+// --binary switches to the binary protocol, see service_stats_t. The tests
+// are skipped so stdout only carries replies.
+// --bench-lookup times binary search against the Eytzinger layout, see
+// bench_lookup. --bench-merge times building the index from generated
+// ranges, see bench_merge.
+int main(int argc, char** argv) {
+    const char* input_name = "input.txt";
+    int bench_exp = 0;
+    size_t bench_ranges = 0;
+    double overlap = 1.0;
+    bool batch = false;
+    const char* index_name = NULL;
+    const char* write_index_name = NULL;
+    const char* compare_name = NULL;
+    long num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    bool serve = false;
+    const char* socket_path = NULL;
+    bool binary = false;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--bench-lookup") == 0) {
+            bench_exp = 8;
+        } else if (strncmp(argv[i], "--bench-lookup=", 15) == 0) {
+            bench_exp = strtol(argv[i] + 15, NULL, 10);
+        } else if (strncmp(argv[i], "--bench-merge=", 14) == 0) {
+            bench_ranges = strtoull(argv[i] + 14, NULL, 10);
+        } else if (strncmp(argv[i], "--overlap=", 10) == 0) {
+            overlap = strtod(argv[i] + 10, NULL);
+        } else if (strncmp(argv[i], "--threads=", 10) == 0) {
+            num_threads = strtol(argv[i] + 10, NULL, 10);
+        } else if (strcmp(argv[i], "--serve") == 0) {
+            serve = true;
+        } else if (strncmp(argv[i], "--serve=", 8) == 0) {
+            serve = true;
+            socket_path = argv[i] + 8;
+        } else if (strcmp(argv[i], "--binary") == 0) {
+            binary = true;
+        } else if (strcmp(argv[i], "--batch") == 0) {
+            batch = true;
+        } else if (strncmp(argv[i], "--index=", 8) == 0) {
+            index_name = argv[i] + 8;
+        } else if (strncmp(argv[i], "--write-index=", 14) == 0) {
+            write_index_name = argv[i] + 14;
+        } else if (strncmp(argv[i], "--compare=", 10) == 0) {
+            compare_name = argv[i] + 10;
+        } else {
+            input_name = argv[i];
         }
     }
-    assert(arr->len > 0);
 
-    size_t num_fresh_ids = 0;
-    range_list_t* list = range_list_create(arr->len);
-    for (size_t i = 0; i < arr->len; i++) {
-        range_list_push_sorted(list, arr->ptr[i]);
-        // range_list_debug_print(list);
+    if (num_threads < 1)
+        num_threads = 1;
+
+    if (!serve) {
+        test_range();
+        test_range_list();
+        test_range_index();
+        test_range_batch();
+        test_range_algebra();
+        test_range_eytzinger();
+        test_range_set();
+        // the slow ones stay off the restart path, an index file loads
+        // without them
+        if (index_name == NULL) {
+            test_range_sort();
+            test_parse();
+            test_range_parallel();
+            test_range_file();
+            test_range_rcu();
+            test_service();
+        }
+        // exit(1);
+    }
+
+    if (bench_exp > 0) {
+        bench_lookup(bench_exp);
+        return 0;
     }
-    range_list_merge(list);
-    printf("\nFINAL LIST (%zu):\n\n", list->len);
-    range_list_debug_print(list);
-    num_fresh_ids = range_list_count_ids(list);
+
+    if (bench_ranges > 0) {
+        bench_merge(bench_ranges, overlap, num_threads);
+        return 0;
+    }
+
+    // one read: the ranges are parsed and indexed, then the ids are checked
+    // straight out of the mapping
+    mapped_input_t* input = NULL;
+    range_file_t* file = NULL;
+    range_array_t* arr = NULL;
+    range_index_t* index;
+    size_t ids = 0;
+    if (index_name != NULL) {
+        file = range_file_map(index_name);
+        index = &file->index;
+        if (!serve) {
+            input = mapped_input_open(input_name);
+            ids = find_id_section(input->data, input->size);
+        }
+    } else {
+        input = mapped_input_open(input_name);
+        arr = parse_ranges(input->data, input->size, &ids);
+        index = range_index_create_parallel(arr, num_threads);
+        if (write_index_name != NULL)
+            range_file_write(index, write_index_name);
+    }
+
+    if (serve) {
+        range_rcu_t* rcu = range_rcu_create(index, socket_path ? SERVICE_MAX_CONNECTIONS : 1);
+        signal(SIGPIPE, SIG_IGN);
+        if (socket_path != NULL) {
+            serve_socket(rcu, socket_path, binary);
+        } else {
+            service_stats_t stats = { 0 };
+            serve_fd(rcu, &rcu->slots[0], STDIN_FILENO, STDOUT_FILENO, binary, &stats);
+            char line[256];
+            service_stats_format(&stats, line, sizeof(line));
+            fputs(line, stderr);
+        }
+        range_rcu_free(rcu);
+        if (file != NULL) {
+            range_file_close(file);
+        } else {
+            range_index_free(index);
+            range_array_free(arr);
+            mapped_input_close(input);
+        }
+        return 0;
+    }
+
+    const char* ids_begin = input->data + ids;
+    const char* ids_end = input->data + input->size;
+
+    size_t fresh;
+    if (batch) {
+        fresh = count_fresh_ids_batch(index, ids_begin, ids_end);
+    } else if (file != NULL) {
+        fresh = count_fresh_ids_parallel(&file->tree, ids_begin, ids_end, num_threads);
+    } else {
+        range_eytzinger_t* tree = range_eytzinger_create(index);
+        fresh = count_fresh_ids_parallel(tree, ids_begin, ids_end, num_threads);
+        range_eytzinger_free(tree);
+    }
+    printf("Part 1: %zu\n", fresh);
+
+    size_t num_fresh_ids = file ? range_file_count_ids(file) : range_index_count_ids(index);
 
     // 118828288127539 is too low 118_828_288_127_539
     // 118828288127590 is too low
     // 344300757540305 is not right, feels close...
     // 333994202581208 is not right, feels closer...
-    // num_fresh_ids = bst_count_ids(list->root);
     // for input2.txt, answer is 344486348901788
     // (i am getting 346228877525236) need to find the bug...
 
     printf("Part 2: %zu\n", num_fresh_ids);
-    fclose(file);
+    if (compare_name != NULL)
+        compare_ranges(index, compare_name);
+    if (file != NULL) {
+        range_file_close(file);
+    } else {
+        range_index_free(index);
+        range_array_free(arr);
+    }
+    mapped_input_close(input);
 }